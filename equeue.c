@@ -31,6 +31,69 @@ static inline void equeue_incid(equeue_t *q, struct equeue_event *e) {
     }
 }
 
+// Hash the local id with the buffer offset for a unique id, or with the
+// event's handle when events can be moved by the compactor
+static inline int equeue_eventid(equeue_t *q, struct equeue_event *e) {
+#ifdef EQUEUE_COMPACT
+    return (e->id << q->npw2) | e->handle;
+#else
+    return (e->id << q->npw2) | ((unsigned char *)e - q->buffer);
+#endif
+}
+
+#ifdef EQUEUE_COMPACT
+// Handles are stored downwards from the end of the buffer
+#define EQUEUE_HANDLE_NONE ((1u << 16)-1)
+
+static inline uintptr_t *equeue_handle(equeue_t *q, unsigned handle) {
+    return &q->handles.slots[-1 - (ptrdiff_t)handle];
+}
+#endif
+
+// Find the event a unique id refers to, the local id still needs checking
+static inline struct equeue_event *equeue_idevent(equeue_t *q, int id) {
+    unsigned local = id & ((1 << q->npw2)-1);
+#ifdef EQUEUE_COMPACT
+    if (local >= q->handles.count || (*equeue_handle(q, local) & 1)) {
+        return 0;
+    }
+
+    return (struct equeue_event *)*equeue_handle(q, local);
+#else
+    return (struct equeue_event *)&q->buffer[local];
+#endif
+}
+
+// Lock the queue, unless it is only ever used from a single thread
+static inline void equeue_lock(equeue_t *q, equeue_mutex_t *m) {
+    if (!q->single) {
+        equeue_mutex_lock(m);
+    }
+}
+
+static inline void equeue_unlock(equeue_t *q, equeue_mutex_t *m) {
+    if (!q->single) {
+        equeue_mutex_unlock(m);
+    }
+}
+
+// Report activity to the trace hook, compiled out without EQUEUE_TRACE
+#ifdef EQUEUE_TRACE
+#define equeue_tracepoint(q, ...) do {                                      \
+    if ((q)->tracer.hook) {                                                 \
+        struct equeue_trace_record r = {.queue = (q), __VA_ARGS__};         \
+        (q)->tracer.hook((q)->tracer.data, &r);                             \
+    }                                                                       \
+} while (0)
+#else
+#define equeue_tracepoint(q, ...) ((void)0)
+#endif
+
+#if defined(EQUEUE_TRACE) || defined(EQUEUE_PROFILE) || \
+    defined(EQUEUE_WATCHDOG)
+static void (*equeue_usercb(struct equeue_event *e))(void *);
+#endif
+
 
 // equeue lifetime management
 int equeue_create(equeue_t *q, size_t size) {
@@ -51,9 +114,26 @@ int equeue_create_inplace(equeue_t *q, size_t size, void *buffer) {
     q->allocated = 0;
 
     q->npw2 = 0;
+#ifdef EQUEUE_COMPACT
+    // the handle table grows down from the end of the buffer as chunks are
+    // carved from the slab, ids only need enough bits for every handle
+    uintptr_t end = ((uintptr_t)buffer + size) & ~(sizeof(uintptr_t)-1);
+    q->handles.slots = (uintptr_t *)end;
+    q->handles.count = 0;
+    q->handles.free = EQUEUE_HANDLE_NONE;
+    size = (unsigned char *)q->handles.slots - (unsigned char *)buffer;
+
+    for (unsigned s = size / sizeof(struct equeue_event); s; s >>= 1) {
+        q->npw2++;
+    }
+    if (q->npw2 > 16) {
+        q->npw2 = 16;
+    }
+#else
     for (unsigned s = size; s; s >>= 1) {
         q->npw2++;
     }
+#endif
 
     q->chunks = 0;
     q->slab.size = size;
@@ -68,6 +148,23 @@ int equeue_create_inplace(equeue_t *q, size_t size, void *buffer) {
     q->background.update = 0;
     q->background.timer = 0;
 
+    q->moderation.window = 0;
+    q->moderation.armed = false;
+    q->single = false;
+
+#ifdef EQUEUE_TRACE
+    q->tracer.hook = 0;
+    q->tracer.data = 0;
+#endif
+
+#ifdef EQUEUE_PROFILE
+    equeue_profile_reset(q);
+#endif
+
+#ifdef EQUEUE_WATCHDOG
+    q->watch.seq = 0;
+#endif
+
     // initialize platform resources
     int err;
     err = equeue_sema_create(&q->eventsema);
@@ -112,12 +209,50 @@ void equeue_destroy(equeue_t *q) {
 
 
 // equeue chunk allocation functions
+#ifdef EQUEUE_COMPACT
+// Each chunk carved from the slab is bound to a handle until the compactor
+// returns it to the slab. Free handles are chained through the table with
+// the low bit set, and remember the local id of their last chunk so ids
+// stay unique when the handle is reused. New handles are taken from the
+// end of the slab.
+
+static bool equeue_handle_alloc(equeue_t *q, struct equeue_event *e,
+        size_t size) {
+    unsigned handle;
+    if (q->handles.free != EQUEUE_HANDLE_NONE) {
+        handle = q->handles.free;
+        uintptr_t slot = *equeue_handle(q, handle);
+        q->handles.free = slot >> 9;
+        e->id = (uint8_t)(slot >> 1);
+        equeue_incid(q, e);
+    } else if (q->handles.count < (1u << q->npw2) &&
+            q->handles.count < EQUEUE_HANDLE_NONE &&
+            q->slab.size >= size + sizeof(uintptr_t)) {
+        handle = q->handles.count++;
+        q->slab.size -= sizeof(uintptr_t);
+        e->id = 1;
+    } else {
+        return false;
+    }
+
+    *equeue_handle(q, handle) = (uintptr_t)e;
+    e->handle = handle;
+    return true;
+}
+
+static void equeue_handle_dealloc(equeue_t *q, struct equeue_event *e) {
+    *equeue_handle(q, e->handle) =
+            ((uintptr_t)q->handles.free << 9) | (e->id << 1) | 1;
+    q->handles.free = e->handle;
+}
+#endif
+
 static struct equeue_event *equeue_mem_alloc(equeue_t *q, size_t size) {
     // add event overhead
     size += sizeof(struct equeue_event);
     size = (size + sizeof(void*)-1) & ~(sizeof(void*)-1);
 
-    equeue_mutex_lock(&q->memlock);
+    equeue_lock(q, &q->memlock);
 
     // check if a good chunk is available
     for (struct equeue_event **p = &q->chunks; *p; p = &(*p)->next) {
@@ -130,7 +265,7 @@ static struct equeue_event *equeue_mem_alloc(equeue_t *q, size_t size) {
                 *p = e->next;
             }
 
-            equeue_mutex_unlock(&q->memlock);
+            equeue_unlock(q, &q->memlock);
             return e;
         }
     }
@@ -138,21 +273,32 @@ static struct equeue_event *equeue_mem_alloc(equeue_t *q, size_t size) {
     // otherwise allocate a new chunk out of the slab
     if (q->slab.size >= size) {
         struct equeue_event *e = (struct equeue_event *)q->slab.data;
+#ifdef EQUEUE_COMPACT
+        if (!equeue_handle_alloc(q, e, size)) {
+            equeue_unlock(q, &q->memlock);
+            return 0;
+        }
+#else
+        e->id = 1;
+#endif
         q->slab.data += size;
         q->slab.size -= size;
         e->size = size;
-        e->id = 1;
 
-        equeue_mutex_unlock(&q->memlock);
+        equeue_unlock(q, &q->memlock);
         return e;
     }
 
-    equeue_mutex_unlock(&q->memlock);
+    equeue_unlock(q, &q->memlock);
     return 0;
 }
 
-static void equeue_mem_dealloc(equeue_t *q, struct equeue_event *e) {
-    equeue_mutex_lock(&q->memlock);
+static void equeue_mem_insert(equeue_t *q, struct equeue_event *e) {
+#ifdef EQUEUE_COMPACT
+    // free chunks refer to the list of chunks so the compactor can tell
+    // them apart in place
+    e->ref = &q->chunks;
+#endif
 
     // stick chunk into list of chunks
     struct equeue_event **p = &q->chunks;
@@ -168,19 +314,48 @@ static void equeue_mem_dealloc(equeue_t *q, struct equeue_event *e) {
         e->next = *p;
     }
     *p = e;
+}
+
+static void equeue_mem_dealloc(equeue_t *q, struct equeue_event *e) {
+    equeue_lock(q, &q->memlock);
+    equeue_mem_insert(q, e);
+    equeue_unlock(q, &q->memlock);
+}
+
+static void equeue_mem_split(equeue_t *q, struct equeue_event *e,
+        size_t size) {
+    // the tail becomes a free chunk if it can hold an event
+    if (e->size - size < sizeof(struct equeue_event)) {
+        return;
+    }
 
-    equeue_mutex_unlock(&q->memlock);
+    struct equeue_event *c = (struct equeue_event *)(
+            (unsigned char *)e + size);
+#ifdef EQUEUE_COMPACT
+    if (!equeue_handle_alloc(q, c, 0)) {
+        return;
+    }
+#else
+    c->id = 1;
+#endif
+    c->size = e->size - size;
+    e->size = size;
+    equeue_mem_insert(q, c);
 }
 
 void *equeue_alloc(equeue_t *q, size_t size) {
     struct equeue_event *e = equeue_mem_alloc(q, size);
     if (!e) {
+        equeue_tracepoint(q, .type = EQUEUE_TRACE_NOMEM, .size = size);
         return 0;
     }
 
     e->target = 0;
     e->period = -1;
     e->dtor = 0;
+#ifdef EQUEUE_COMPACT
+    e->ref = 0;
+#endif
 
     return e + 1;
 }
@@ -195,16 +370,60 @@ void equeue_dealloc(equeue_t *q, void *p) {
     equeue_mem_dealloc(q, e);
 }
 
+void *equeue_realloc(equeue_t *q, void *p, size_t size) {
+    struct equeue_event *e = (struct equeue_event*)p - 1;
+    size_t old = e->size - sizeof(struct equeue_event);
+    size_t need = size + sizeof(struct equeue_event);
+    need = (need + sizeof(void*)-1) & ~(sizeof(void*)-1);
+
+    equeue_lock(q, &q->memlock);
+
+    // the chunk at the top of the used memory grows and shrinks into the
+    // slab, no other chunk ever starts in the memory it hands back
+    if ((unsigned char *)e + e->size == q->slab.data &&
+            (need <= e->size || q->slab.size >= need - e->size)) {
+        q->slab.data = (unsigned char *)e + need;
+        q->slab.size = q->slab.size + e->size - need;
+        e->size = need;
+
+        equeue_unlock(q, &q->memlock);
+        return p;
+    }
+
+    // otherwise a chunk can only shrink, chunks are never merged since
+    // the ids of old events encode where their chunks started
+    if (need <= e->size) {
+        equeue_mem_split(q, e, need);
+        equeue_unlock(q, &q->memlock);
+        return p;
+    }
+
+    equeue_unlock(q, &q->memlock);
+
+    // move into a new chunk, the old event stays valid on failure
+    void *n = equeue_alloc(q, size);
+    if (!n) {
+        return 0;
+    }
+
+    struct equeue_event *ne = (struct equeue_event*)n - 1;
+    ne->target = e->target;
+    ne->period = e->period;
+    ne->dtor = e->dtor;
+    memcpy(n, p, old);
+
+    equeue_mem_dealloc(q, e);
+    return n;
+}
+
 
 // equeue scheduling functions
-static int equeue_enqueue(equeue_t *q, struct equeue_event *e, unsigned tick) {
+static int equeue_insert(equeue_t *q, struct equeue_event *e, unsigned tick) {
     // setup event and hash local id with buffer offset for unique id
-    int id = (e->id << q->npw2) | ((unsigned char *)e - q->buffer);
+    int id = equeue_eventid(q, e);
     e->target = tick + equeue_clampdiff(e->target, tick);
     e->generation = q->generation;
 
-    equeue_mutex_lock(&q->queuelock);
-
     // find the event slot
     struct equeue_event **p = &q->queue;
     while (*p && equeue_tickdiff((*p)->target, e->target) < 0) {
@@ -219,6 +438,7 @@ static int equeue_enqueue(equeue_t *q, struct equeue_event *e, unsigned tick) {
         }
 
         e->sibling = *p;
+        e->sibling->next = 0;
         e->sibling->ref = &e->sibling;
     } else {
         e->next = *p;
@@ -239,19 +459,23 @@ static int equeue_enqueue(equeue_t *q, struct equeue_event *e, unsigned tick) {
                 equeue_clampdiff(e->target, tick));
     }
 
-    equeue_mutex_unlock(&q->queuelock);
+    return id;
+}
+
+static int equeue_enqueue(equeue_t *q, struct equeue_event *e, unsigned tick) {
+    equeue_lock(q, &q->queuelock);
+    int id = equeue_insert(q, e, tick);
+    equeue_unlock(q, &q->queuelock);
 
     return id;
 }
 
 static struct equeue_event *equeue_unqueue(equeue_t *q, int id) {
     // decode event from unique id and check that the local id matches
-    struct equeue_event *e = (struct equeue_event *)
-            &q->buffer[id & ((1 << q->npw2)-1)];
-
-    equeue_mutex_lock(&q->queuelock);
-    if (e->id != id >> q->npw2) {
-        equeue_mutex_unlock(&q->queuelock);
+    equeue_lock(q, &q->queuelock);
+    struct equeue_event *e = equeue_idevent(q, id);
+    if (!e || e->id != id >> q->npw2) {
+        equeue_unlock(q, &q->queuelock);
         return 0;
     }
 
@@ -261,7 +485,7 @@ static struct equeue_event *equeue_unqueue(equeue_t *q, int id) {
 
     int diff = equeue_tickdiff(e->target, q->tick);
     if (diff < 0 || (diff == 0 && e->generation != q->generation)) {
-        equeue_mutex_unlock(&q->queuelock);
+        equeue_unlock(q, &q->queuelock);
         return 0;
     }
 
@@ -282,13 +506,13 @@ static struct equeue_event *equeue_unqueue(equeue_t *q, int id) {
     }
 
     equeue_incid(q, e);
-    equeue_mutex_unlock(&q->queuelock);
+    equeue_unlock(q, &q->queuelock);
 
     return e;
 }
 
 static struct equeue_event *equeue_dequeue(equeue_t *q, unsigned target) {
-    equeue_mutex_lock(&q->queuelock);
+    equeue_lock(q, &q->queuelock);
 
     // find all expired events and mark a new generation
     q->generation += 1;
@@ -309,7 +533,7 @@ static struct equeue_event *equeue_dequeue(equeue_t *q, unsigned target) {
 
     *p = 0;
 
-    equeue_mutex_unlock(&q->queuelock);
+    equeue_unlock(q, &q->queuelock);
 
     // reverse and flatten each slot to match insertion order
     struct equeue_event **tail = &head;
@@ -337,16 +561,63 @@ int equeue_post(equeue_t *q, void (*cb)(void*), void *p) {
     e->cb = cb;
     e->target = tick + e->target;
 
-    int id = equeue_enqueue(q, e, tick);
-    equeue_sema_signal(&q->eventsema);
+    // once enqueued the event may be dispatched at any time
+    equeue_tracepoint(q, .type = EQUEUE_TRACE_POST,
+            .id = equeue_eventid(q, e), .cb = equeue_usercb(e),
+            .size = e->size, .delay = equeue_clampdiff(e->target, tick),
+            .period = e->period);
+
+    equeue_lock(q, &q->queuelock);
+    int id = equeue_insert(q, e, tick);
+    bool armed = q->moderation.armed;
+    equeue_unlock(q, &q->queuelock);
+
+    // a dispatch loop that is due to wake soon picks up the event anyway,
+    // and a single-threaded queue can only be posted to while not waiting
+    if (!armed && !q->single) {
+        equeue_sema_signal(&q->eventsema);
+    }
+
     return id;
 }
 
+void equeue_post_batch(equeue_t *q, void (*cb)(void*),
+        void **events, unsigned count, int *ids) {
+    unsigned tick = equeue_tick();
+    for (unsigned i = 0; i < count; i++) {
+        struct equeue_event *e = (struct equeue_event*)events[i] - 1;
+        e->cb = cb;
+        e->target = tick + e->target;
+
+        equeue_tracepoint(q, .type = EQUEUE_TRACE_POST,
+                .id = equeue_eventid(q, e), .cb = equeue_usercb(e),
+                .size = e->size, .delay = equeue_clampdiff(e->target, tick),
+                .period = e->period);
+    }
+
+    // the whole batch is inserted under one lock and signalled once
+    equeue_lock(q, &q->queuelock);
+    for (unsigned i = 0; i < count; i++) {
+        int id = equeue_insert(q, (struct equeue_event*)events[i] - 1, tick);
+        if (ids) {
+            ids[i] = id;
+        }
+    }
+    bool armed = q->moderation.armed;
+    equeue_unlock(q, &q->queuelock);
+
+    if (count && !armed && !q->single) {
+        equeue_sema_signal(&q->eventsema);
+    }
+}
+
 void equeue_cancel(equeue_t *q, int id) {
     if (!id) {
         return;
     }
 
+    equeue_tracepoint(q, .type = EQUEUE_TRACE_CANCEL, .id = id);
+
     struct equeue_event *e = equeue_unqueue(q, id);
     if (e) {
         equeue_dealloc(q, e + 1);
@@ -354,12 +625,39 @@ void equeue_cancel(equeue_t *q, int id) {
 }
 
 void equeue_break(equeue_t *q) {
-    equeue_mutex_lock(&q->queuelock);
+    equeue_lock(q, &q->queuelock);
     q->breaks++;
-    equeue_mutex_unlock(&q->queuelock);
+    equeue_unlock(q, &q->queuelock);
     equeue_sema_signal(&q->eventsema);
 }
 
+#ifdef EQUEUE_PROFILE
+static void equeue_profile_record(equeue_t *q, void (*cb)(void *),
+        unsigned runtime, int late) {
+    // open addressing on a hash of the function pointer
+    unsigned i = (unsigned)(((uintptr_t)cb >> 2) * 2654435761u)
+            % EQUEUE_PROFILE_SIZE;
+
+    for (unsigned n = 0; n < EQUEUE_PROFILE_SIZE; n++) {
+        struct equeue_profile *p = &q->profiler.entries[i];
+        if (p->cb == cb || !p->cb) {
+            p->cb = cb;
+            p->calls += 1;
+            p->runtime += runtime;
+            p->lateness += late;
+            if (runtime > p->max_runtime) {
+                p->max_runtime = runtime;
+            }
+            return;
+        }
+
+        i = (i + 1) % EQUEUE_PROFILE_SIZE;
+    }
+
+    q->profiler.untracked += 1;
+}
+#endif
+
 void equeue_dispatch(equeue_t *q, int ms) {
     unsigned tick = equeue_tick();
     unsigned timeout = tick + ms;
@@ -368,6 +666,17 @@ void equeue_dispatch(equeue_t *q, int ms) {
     while (1) {
         // collect all the available events and next deadline
         struct equeue_event *es = equeue_dequeue(q, tick);
+        bool busy = es;
+
+#ifdef EQUEUE_TRACE
+        if (es && q->tracer.hook) {
+            unsigned count = 0;
+            for (struct equeue_event *e = es; e; e = e->next) {
+                count += 1;
+            }
+            equeue_tracepoint(q, .type = EQUEUE_TRACE_BATCH, .count = count);
+        }
+#endif
 
         // dispatch events
         while (es) {
@@ -377,7 +686,29 @@ void equeue_dispatch(equeue_t *q, int ms) {
             // actually dispatch the callbacks
             void (*cb)(void *) = e->cb;
             if (cb) {
+#ifdef EQUEUE_PROFILE
+                void (*ucb)(void *) = equeue_usercb(e);
+                int late = equeue_clampdiff(equeue_tick(), e->target);
+                unsigned start = equeue_utick();
+#endif
+#ifdef EQUEUE_WATCHDOG
+                // publish the running callback, odd seq marks it valid
+                q->watch.cb = equeue_usercb(e);
+                q->watch.id = equeue_eventid(q, e);
+                q->watch.start = equeue_tick();
+                q->watch.seq += 1;
+#endif
+                equeue_tracepoint(q, .type = EQUEUE_TRACE_CALL,
+                        .id = equeue_eventid(q, e), .cb = equeue_usercb(e));
                 cb(e + 1);
+                equeue_tracepoint(q, .type = EQUEUE_TRACE_RETURN,
+                        .id = equeue_eventid(q, e), .cb = equeue_usercb(e));
+#ifdef EQUEUE_WATCHDOG
+                q->watch.seq += 1;
+#endif
+#ifdef EQUEUE_PROFILE
+                equeue_profile_record(q, ucb, equeue_utick() - start, late);
+#endif
             }
 
             // reenqueue periodic events or deallocate
@@ -399,40 +730,63 @@ void equeue_dispatch(equeue_t *q, int ms) {
             if (deadline <= 0) {
                 // update background timer if necessary
                 if (q->background.update) {
-                    equeue_mutex_lock(&q->queuelock);
-                    if (q->background.update && q->queue) {
-                        q->background.update(q->background.timer,
-                                equeue_clampdiff(q->queue->target, tick));
+                    equeue_lock(q, &q->queuelock);
+                    if (q->background.update) {
+                        q->background.update(q->background.timer, q->queue
+                                ? equeue_clampdiff(q->queue->target, tick)
+                                : -1);
                     }
                     q->background.active = true;
-                    equeue_mutex_unlock(&q->queuelock);
+                    equeue_unlock(q, &q->queuelock);
                 }
+                q->moderation.armed = false;
                 return;
             }
         }
 
         // find closest deadline
-        equeue_mutex_lock(&q->queuelock);
+        equeue_lock(q, &q->queuelock);
         if (q->queue) {
             int diff = equeue_clampdiff(q->queue->target, tick);
             if ((unsigned)diff < (unsigned)deadline) {
                 deadline = diff;
             }
         }
-        equeue_mutex_unlock(&q->queuelock);
 
-        // wait for events
-        equeue_sema_wait(&q->eventsema, deadline);
+        // while events keep arriving wake up at least every window, posts
+        // don't need to signal while a wakeup is due within the window
+        if (q->moderation.window) {
+            if (busy && (unsigned)q->moderation.window < (unsigned)deadline) {
+                deadline = q->moderation.window;
+            }
+            q->moderation.armed =
+                    (unsigned)deadline <= (unsigned)q->moderation.window;
+        }
+        equeue_unlock(q, &q->queuelock);
+
+        // wait for events, a single-threaded queue with events already due
+        // skips the wait unless it has sources to poll
+#if defined(EQUEUE_PLATFORM_POSIX) && defined(__linux__)
+        bool sources = q->eventsema.epoll >= 0;
+#else
+        bool sources = false;
+#endif
+        if (deadline || !q->single || sources) {
+            equeue_tracepoint(q, .type = EQUEUE_TRACE_SLEEP, .delay = deadline);
+            equeue_sema_wait(&q->eventsema, deadline);
+            equeue_tracepoint(q, .type = EQUEUE_TRACE_WAKE);
+        }
 
         // check if we were notified to break out of dispatch
         if (q->breaks) {
-            equeue_mutex_lock(&q->queuelock);
+            equeue_lock(q, &q->queuelock);
             if (q->breaks > 0) {
                 q->breaks--;
-                equeue_mutex_unlock(&q->queuelock);
+                q->moderation.armed = false;
+                equeue_unlock(q, &q->queuelock);
                 return;
             }
-            equeue_mutex_unlock(&q->queuelock);
+            equeue_unlock(q, &q->queuelock);
         }
 
         // update tick for next iteration
@@ -441,6 +795,18 @@ void equeue_dispatch(equeue_t *q, int ms) {
 }
 
 
+void equeue_moderate(equeue_t *q, int window) {
+    equeue_lock(q, &q->queuelock);
+    q->moderation.window = window > 0 ? window : 0;
+    q->moderation.armed = false;
+    equeue_unlock(q, &q->queuelock);
+}
+
+void equeue_single_thread(equeue_t *q, bool single) {
+    q->single = single;
+}
+
+
 // event functions
 void equeue_event_delay(void *p, int ms) {
     struct equeue_event *e = (struct equeue_event*)p - 1;
@@ -469,6 +835,18 @@ static void ecallback_dispatch(void *p) {
     e->cb(e->data);
 }
 
+#if defined(EQUEUE_TRACE) || defined(EQUEUE_PROFILE) || \
+    defined(EQUEUE_WATCHDOG)
+static void (*equeue_usercb(struct equeue_event *e))(void *) {
+    // report the user's callback instead of the trampoline
+    if (e->cb == ecallback_dispatch) {
+        return ((struct ecallback *)(e + 1))->cb;
+    }
+
+    return e->cb;
+}
+#endif
+
 int equeue_call(equeue_t *q, void (*cb)(void*), void *data) {
     struct ecallback *e = equeue_alloc(q, sizeof(struct ecallback));
     if (!e) {
@@ -506,10 +884,225 @@ int equeue_call_every(equeue_t *q, int ms, void (*cb)(void*), void *data) {
 }
 
 
+#ifdef EQUEUE_TRACE
+// tracing
+void equeue_trace(equeue_t *q,
+        void (*hook)(void *data, const struct equeue_trace_record *record),
+        void *data) {
+    equeue_lock(q, &q->queuelock);
+    q->tracer.hook = hook;
+    q->tracer.data = data;
+    equeue_unlock(q, &q->queuelock);
+}
+#endif
+
+#ifdef EQUEUE_PROFILE
+// profiling
+void equeue_profile_reset(equeue_t *q) {
+    memset(&q->profiler, 0, sizeof(q->profiler));
+}
+#endif
+
+#ifdef EQUEUE_WATCHDOG
+// watchdog
+void equeue_watchdog_create(equeue_watchdog_t *w, equeue_t *q, int threshold,
+        void (*hook)(void *data, const struct equeue_overrun *overrun),
+        void *data) {
+    w->queue = q;
+    w->threshold = threshold;
+    w->hook = hook;
+    w->data = data;
+    w->reported = q->watch.seq & ~1u;
+}
+
+int equeue_watchdog_check(equeue_watchdog_t *w) {
+    equeue_t *q = w->queue;
+
+    // only report each callback once, and only while it is running
+    unsigned seq = q->watch.seq;
+    if (!(seq & 1) || seq == w->reported) {
+        return 0;
+    }
+
+    struct equeue_overrun o;
+    o.queue = q;
+    o.cb = q->watch.cb;
+    o.id = q->watch.id;
+    unsigned start = q->watch.start;
+    if (q->watch.seq != seq) {
+        return 0;
+    }
+
+    o.duration = equeue_clampdiff(equeue_tick(), start);
+    if (o.duration < w->threshold) {
+        return 0;
+    }
+
+    w->reported = seq;
+    w->hook(w->data, &o);
+    return 1;
+}
+#endif
+
+#ifdef EQUEUE_COMPACT
+// compaction
+//
+// Chunks are classified in place. Free chunks refer to the list of chunks,
+// allocated chunks have no ref until posted, and posted chunks are pending
+// until dequeued for dispatch, the same test equeue_unqueue uses.
+static inline bool equeue_chunk_isfree(equeue_t *q, struct equeue_event *c) {
+    return c->ref == &q->chunks;
+}
+
+static inline bool equeue_chunk_ispending(equeue_t *q,
+        struct equeue_event *c) {
+    if (!c->ref || equeue_chunk_isfree(q, c)) {
+        return false;
+    }
+
+    int diff = equeue_tickdiff(c->target, q->tick);
+    return diff > 0 || (diff == 0 && c->generation == q->generation);
+}
+
+static void equeue_chunk_unlink(struct equeue_event **p,
+        struct equeue_event **s) {
+    // remove *s, which is *p or one of its siblings
+    struct equeue_event *c = *s;
+    if (s == p) {
+        if (c->sibling) {
+            *p = c->sibling;
+            (*p)->next = c->next;
+        } else {
+            *p = c->next;
+        }
+    } else {
+        *s = c->sibling;
+    }
+}
+
+static void equeue_chunk_remove(equeue_t *q, struct equeue_event *c) {
+    for (struct equeue_event **p = &q->chunks; *p; p = &(*p)->next) {
+        if ((*p)->size != c->size) {
+            continue;
+        }
+
+        for (struct equeue_event **s = p; *s; s = &(*s)->sibling) {
+            if (*s == c) {
+                equeue_chunk_unlink(p, s);
+                return;
+            }
+        }
+        return;
+    }
+}
+
+static struct equeue_event *equeue_chunk_take(equeue_t *q,
+        struct equeue_event *top) {
+    // take the smallest free chunk below top that fits it
+    for (struct equeue_event **p = &q->chunks; *p; p = &(*p)->next) {
+        if ((*p)->size < top->size) {
+            continue;
+        }
+
+        for (struct equeue_event **s = p; *s; s = &(*s)->sibling) {
+            if (*s < top) {
+                struct equeue_event *d = *s;
+                equeue_chunk_unlink(p, s);
+                return d;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static void equeue_chunk_move(equeue_t *q,
+        struct equeue_event *e, struct equeue_event *d) {
+    // the contents and handle move into the free chunk, which keeps its
+    // size, the old chunk takes over the free chunk's handle
+    unsigned size = d->size;
+    unsigned handle = d->handle;
+    uint8_t id = d->id;
+
+    memcpy(d, e, e->size);
+    d->size = size;
+    *equeue_handle(q, d->handle) = (uintptr_t)d;
+
+    e->handle = handle;
+    e->id = id;
+    *equeue_handle(q, e->handle) = (uintptr_t)e;
+
+    // relink the queue around the new location
+    *d->ref = d;
+    if (d->next) {
+        d->next->ref = &d->next;
+    }
+    if (d->sibling) {
+        d->sibling->ref = &d->sibling;
+    }
+
+    equeue_mem_insert(q, e);
+}
+
+static int equeue_compact_step(equeue_t *q) {
+    if (q->slab.data == q->buffer) {
+        return -1;
+    }
+
+    // find the chunk at the top of the used part of the buffer
+    struct equeue_event *top = (struct equeue_event *)q->buffer;
+    while ((unsigned char *)top + top->size != q->slab.data) {
+        top = (struct equeue_event *)((unsigned char *)top + top->size);
+    }
+
+    // free chunks at the top go back to the slab
+    if (equeue_chunk_isfree(q, top)) {
+        equeue_chunk_remove(q, top);
+        equeue_handle_dealloc(q, top);
+        q->slab.data -= top->size;
+        q->slab.size += top->size;
+        return top->size;
+    }
+
+    // pending events move down into the smallest free chunk that fits
+    if (!equeue_chunk_ispending(q, top)) {
+        return -1;
+    }
+
+    struct equeue_event *d = equeue_chunk_take(q, top);
+    if (!d) {
+        return -1;
+    }
+
+    equeue_chunk_move(q, top, d);
+    return 0;
+}
+
+size_t equeue_compact(equeue_t *q) {
+    // the locks are released after each chunk so posts, cancels and
+    // dispatch are only ever held up by a single step
+    size_t compacted = 0;
+    while (1) {
+        equeue_lock(q, &q->queuelock);
+        equeue_lock(q, &q->memlock);
+        int step = equeue_compact_step(q);
+        equeue_unlock(q, &q->memlock);
+        equeue_unlock(q, &q->queuelock);
+
+        if (step < 0) {
+            return compacted;
+        }
+
+        compacted += step;
+    }
+}
+#endif
+
+
 // backgrounding
 void equeue_background(equeue_t *q,
         void (*update)(void *timer, int ms), void *timer) {
-    equeue_mutex_lock(&q->queuelock);
+    equeue_lock(q, &q->queuelock);
     if (q->background.update) {
         q->background.update(q->background.timer, -1);
     }
@@ -522,7 +1115,7 @@ void equeue_background(equeue_t *q,
                 equeue_clampdiff(q->queue->target, equeue_tick()));
     }
     q->background.active = true;
-    equeue_mutex_unlock(&q->queuelock);
+    equeue_unlock(q, &q->queuelock);
 }
 
 struct equeue_chain_context {
@@ -538,26 +1131,523 @@ static void equeue_chain_dispatch(void *p) {
 static void equeue_chain_update(void *p, int ms) {
     struct equeue_chain_context *c = (struct equeue_chain_context *)p;
     equeue_cancel(c->target, c->id);
+    c->id = 0;
 
     if (ms >= 0) {
         c->id = equeue_call_in(c->target, ms, equeue_chain_dispatch, c->q);
-    } else {
-        equeue_dealloc(c->target, c);
     }
 }
 
 void equeue_chain(equeue_t *q, equeue_t *target) {
+    // the context lives in the chained queue until it is unchained
+    struct equeue_chain_context *old = 0;
+    if (q->background.update == equeue_chain_update) {
+        old = (struct equeue_chain_context *)q->background.timer;
+    }
+
     if (!target) {
         equeue_background(q, 0, 0);
-        return;
+    } else {
+        struct equeue_chain_context *c = equeue_alloc(q,
+                sizeof(struct equeue_chain_context));
+
+        c->q = q;
+        c->target = target;
+        c->id = 0;
+
+        equeue_background(q, equeue_chain_update, c);
+    }
+
+    if (old) {
+        equeue_dealloc(q, old);
+    }
+}
+
+
+// message channels
+static void equeue_chan_dispatch(void *p) {
+    equeue_chan_t *c = (equeue_chan_t *)p;
+
+    // deliver the messages that are available now in contiguous batches,
+    // producers only write to free slots so the lock can be released
+    equeue_mutex_lock(&c->lock);
+    unsigned head = c->head;
+    unsigned count = c->count;
+    equeue_mutex_unlock(&c->lock);
+
+    while (count) {
+        unsigned n = count;
+        if (n > c->capacity - head) {
+            n = c->capacity - head;
+        }
+
+        c->cb(c->data, &c->buffer[head*c->size], n);
+
+        head = (head + n) % c->capacity;
+        count -= n;
+
+        equeue_mutex_lock(&c->lock);
+        c->head = head;
+        c->count -= n;
+        equeue_mutex_unlock(&c->lock);
+    }
+
+    // post a follow-up event for anything sent while we were busy
+    equeue_mutex_lock(&c->lock);
+    c->id = c->count ? equeue_call(c->queue, equeue_chan_dispatch, c) : 0;
+    equeue_mutex_unlock(&c->lock);
+}
+
+int equeue_chan_create(equeue_chan_t *c, equeue_t *q,
+        size_t size, unsigned capacity,
+        void (*cb)(void *data, void *msgs, unsigned count), void *data) {
+    c->buffer = equeue_alloc(q, size*capacity);
+    if (!c->buffer) {
+        return -1;
     }
 
-    struct equeue_chain_context *c = equeue_alloc(q,
-            sizeof(struct equeue_chain_context));
+    int err = equeue_mutex_create(&c->lock);
+    if (err < 0) {
+        equeue_dealloc(q, c->buffer);
+        return err;
+    }
 
-    c->q = q;
-    c->target = target;
+    c->queue = q;
+    c->size = size;
+    c->capacity = capacity;
+    c->head = 0;
+    c->count = 0;
     c->id = 0;
+    c->cb = cb;
+    c->data = data;
+    return 0;
+}
+
+void equeue_chan_destroy(equeue_chan_t *c) {
+    equeue_cancel(c->queue, c->id);
+    equeue_dealloc(c->queue, c->buffer);
+    equeue_mutex_destroy(&c->lock);
+}
+
+int equeue_chan_send(equeue_chan_t *c, const void *msg) {
+    equeue_mutex_lock(&c->lock);
+    if (c->count == c->capacity) {
+        equeue_mutex_unlock(&c->lock);
+        return -1;
+    }
+
+    unsigned slot = (c->head + c->count) % c->capacity;
+    memcpy(&c->buffer[slot*c->size], msg, c->size);
+
+    // only the first message of a batch needs a delivery event
+    if (!c->id) {
+        c->id = equeue_call(c->queue, equeue_chan_dispatch, c);
+        if (!c->id) {
+            equeue_mutex_unlock(&c->lock);
+            return -1;
+        }
+    }
+
+    c->count += 1;
+    equeue_mutex_unlock(&c->lock);
+    return 0;
+}
+
+// publish-subscribe topics
+struct equeue_topic_sub {
+    struct equeue_topic_sub *next;
+    equeue_t *q;
+    void (*cb)(void *data, const void *payload);
+    void *data;
+};
+
+struct equeue_topic_payload {
+    equeue_topic_t *topic;
+    size_t refs;
+    // payload follows
+};
+
+struct equeue_topic_delivery {
+    void (*cb)(void *data, const void *payload);
+    void *data;
+    struct equeue_topic_payload *payload;
+};
+
+static void equeue_topic_release(struct equeue_topic_payload *p) {
+    equeue_topic_t *t = p->topic;
+    equeue_mutex_lock(&t->lock);
+    p->refs -= 1;
+    size_t refs = p->refs;
+    equeue_mutex_unlock(&t->lock);
+
+    if (!refs) {
+        equeue_dealloc(t->arena, p);
+    }
+}
+
+static void equeue_topic_dispatch(void *p) {
+    struct equeue_topic_delivery *d = (struct equeue_topic_delivery *)p;
+    d->cb(d->data, d->payload + 1);
+}
+
+static void equeue_topic_dtor(void *p) {
+    struct equeue_topic_delivery *d = (struct equeue_topic_delivery *)p;
+    equeue_topic_release(d->payload);
+}
+
+int equeue_topic_create(equeue_topic_t *t, equeue_t *arena) {
+    t->arena = arena;
+    t->subs = 0;
+    return equeue_mutex_create(&t->lock);
+}
+
+void equeue_topic_destroy(equeue_topic_t *t) {
+    while (t->subs) {
+        struct equeue_topic_sub *s = t->subs;
+        t->subs = s->next;
+        equeue_dealloc(t->arena, s);
+    }
+
+    equeue_mutex_destroy(&t->lock);
+}
+
+void *equeue_topic_subscribe(equeue_topic_t *t, equeue_t *q,
+        void (*cb)(void *data, const void *payload), void *data) {
+    struct equeue_topic_sub *s = equeue_alloc(t->arena,
+            sizeof(struct equeue_topic_sub));
+    if (!s) {
+        return 0;
+    }
+
+    s->q = q;
+    s->cb = cb;
+    s->data = data;
+
+    equeue_mutex_lock(&t->lock);
+    s->next = t->subs;
+    t->subs = s;
+    equeue_mutex_unlock(&t->lock);
+    return s;
+}
+
+void equeue_topic_unsubscribe(equeue_topic_t *t, void *sub) {
+    equeue_mutex_lock(&t->lock);
+    for (struct equeue_topic_sub **p = &t->subs; *p; p = &(*p)->next) {
+        if (*p == sub) {
+            *p = (*p)->next;
+            break;
+        }
+    }
+    equeue_mutex_unlock(&t->lock);
+
+    equeue_dealloc(t->arena, sub);
+}
+
+void *equeue_topic_alloc(equeue_topic_t *t, size_t size) {
+    struct equeue_topic_payload *p = equeue_alloc(t->arena,
+            sizeof(struct equeue_topic_payload) + size);
+    if (!p) {
+        return 0;
+    }
+
+    p->topic = t;
+    p->refs = 1;
+    return p + 1;
+}
+
+void equeue_topic_dealloc(equeue_topic_t *t, void *payload) {
+    equeue_dealloc(t->arena, (struct equeue_topic_payload *)payload - 1);
+}
+
+int equeue_topic_publish(equeue_topic_t *t, void *payload) {
+    struct equeue_topic_payload *p = (struct equeue_topic_payload *)payload - 1;
+    int count = 0;
+
+    // the publisher's reference keeps the payload alive while posting
+    equeue_mutex_lock(&t->lock);
+    for (struct equeue_topic_sub *s = t->subs; s; s = s->next) {
+        struct equeue_topic_delivery *d = equeue_alloc(s->q,
+                sizeof(struct equeue_topic_delivery));
+        if (!d) {
+            continue;
+        }
+
+        d->cb = s->cb;
+        d->data = s->data;
+        d->payload = p;
+        p->refs += 1;
+
+        equeue_event_dtor(d, equeue_topic_dtor);
+        equeue_post(s->q, equeue_topic_dispatch, d);
+        count += 1;
+    }
+    equeue_mutex_unlock(&t->lock);
+
+    equeue_topic_release(p);
+    return count;
+}
+
+// reference-counted external payloads
+struct equeue_buf_delivery {
+    void (*cb)(void *data, const void *payload, size_t size);
+    void *data;
+    equeue_buf_t *buf;
+};
+
+static void equeue_buf_dispatch(void *p) {
+    struct equeue_buf_delivery *d = (struct equeue_buf_delivery *)p;
+    d->cb(d->data, d->buf->payload, d->buf->size);
+}
+
+static void equeue_buf_dtor(void *p) {
+    struct equeue_buf_delivery *d = (struct equeue_buf_delivery *)p;
+    equeue_buf_release(d->buf);
+}
+
+int equeue_buf_create(equeue_buf_t *b, const void *payload, size_t size,
+        void (*release)(void *data, const void *payload), void *data) {
+    b->payload = payload;
+    b->size = size;
+    b->refs = 1;
+    b->release = release;
+    b->data = data;
+    return equeue_mutex_create(&b->lock);
+}
+
+void equeue_buf_retain(equeue_buf_t *b) {
+    equeue_mutex_lock(&b->lock);
+    b->refs += 1;
+    equeue_mutex_unlock(&b->lock);
+}
+
+void equeue_buf_release(equeue_buf_t *b) {
+    equeue_mutex_lock(&b->lock);
+    b->refs -= 1;
+    unsigned refs = b->refs;
+    equeue_mutex_unlock(&b->lock);
+
+    // the release function may free the buffer itself
+    if (!refs) {
+        equeue_mutex_destroy(&b->lock);
+        if (b->release) {
+            b->release(b->data, b->payload);
+        }
+    }
+}
+
+int equeue_buf_call(equeue_buf_t *b, equeue_t *q, int ms,
+        void (*cb)(void *data, const void *payload, size_t size), void *data) {
+    struct equeue_buf_delivery *d = equeue_alloc(q,
+            sizeof(struct equeue_buf_delivery));
+    if (!d) {
+        return 0;
+    }
+
+    d->cb = cb;
+    d->data = data;
+    d->buf = b;
+    equeue_buf_retain(b);
+
+    equeue_event_delay(d, ms);
+    equeue_event_dtor(d, equeue_buf_dtor);
+    return equeue_post(q, equeue_buf_dispatch, d);
+}
+
+// parallel loops
+struct equeue_parallel {
+    size_t next;
+    size_t end;
+    size_t grain;
+    unsigned pending;
+
+    void (*fn)(void *data, size_t begin, size_t end);
+    void (*map)(void *data, size_t begin, size_t end, void *acc);
+    void (*combine)(void *data, void *result, const void *acc);
+    void *data;
+    void *result;
+    const void *identity;
+    size_t size;
+
+    equeue_mutex_t lock;
+    equeue_sema_t done;
+};
+
+struct equeue_parallel_worker {
+    struct equeue_parallel *p;
+    // accumulator follows
+};
+
+static void equeue_parallel_run(struct equeue_parallel *p, void *acc) {
+    bool ran = false;
+    while (1) {
+        // claim the next chunk
+        equeue_mutex_lock(&p->lock);
+        size_t begin = p->next;
+        size_t end = begin + (p->end - begin < p->grain
+                ? p->end - begin : p->grain);
+        p->next = end;
+        equeue_mutex_unlock(&p->lock);
+
+        if (begin == end) {
+            break;
+        }
+
+        if (p->map) {
+            p->map(p->data, begin, end, acc);
+        } else {
+            p->fn(p->data, begin, end);
+        }
+        ran = true;
+    }
+
+    // participants that claimed no chunks have nothing to combine
+    if (ran && p->combine && acc && acc != p->result) {
+        equeue_mutex_lock(&p->lock);
+        p->combine(p->data, p->result, acc);
+        equeue_mutex_unlock(&p->lock);
+    }
+}
+
+static void equeue_parallel_dispatch(void *e) {
+    struct equeue_parallel_worker *w = (struct equeue_parallel_worker *)e;
+    equeue_parallel_run(w->p, w + 1);
+}
+
+static void equeue_parallel_release(void *e) {
+    // runs after a worker completes or is cancelled, signal while
+    // holding the lock, the caller may destroy the context right after
+    struct equeue_parallel *p = ((struct equeue_parallel_worker *)e)->p;
+    equeue_mutex_lock(&p->lock);
+    p->pending -= 1;
+    if (!p->pending) {
+        equeue_sema_signal(&p->done);
+    }
+    equeue_mutex_unlock(&p->lock);
+}
+
+static int equeue_parallel(equeue_group_t *g, struct equeue_parallel *p) {
+    int err = equeue_mutex_create(&p->lock);
+    if (err < 0) {
+        return err;
+    }
+
+    err = equeue_sema_create(&p->done);
+    if (err < 0) {
+        equeue_mutex_destroy(&p->lock);
+        return err;
+    }
+
+    if (!p->grain) {
+        p->grain = 1;
+    }
+
+    // allocate every accumulator before posting any worker, each starts
+    // from the identity, skipping queues that are out of memory
+    size_t wsize = sizeof(struct equeue_parallel_worker) + p->size;
+    struct equeue_parallel_worker *ws[g->count + 1];
+    int ids[g->count + 1];
+
+    for (unsigned i = 0; i < g->count + 1; i++) {
+        ws[i] = 0;
+        if (i == g->count && (!g->count || !p->size)) {
+            break;
+        }
+
+        ws[i] = equeue_alloc(g->queues[i < g->count ? i : 0], wsize);
+        if (ws[i]) {
+            ws[i]->p = p;
+            if (p->identity) {
+                memcpy(ws[i] + 1, p->identity, p->size);
+            } else {
+                memset(ws[i] + 1, 0, p->size);
+            }
+        }
+    }
+
+    // post a worker on each queue, the last accumulator is our own
+    p->pending = 0;
+    for (unsigned i = 0; i < g->count; i++) {
+        ids[i] = 0;
+        if (!ws[i]) {
+            continue;
+        }
+
+        equeue_mutex_lock(&p->lock);
+        p->pending += 1;
+        equeue_mutex_unlock(&p->lock);
+
+        equeue_event_dtor(ws[i], equeue_parallel_release);
+        ids[i] = equeue_post(g->queues[i], equeue_parallel_dispatch, ws[i]);
+    }
+
+    // participate from the calling thread, if no workers were posted
+    // we can fold directly into the result
+    equeue_mutex_lock(&p->lock);
+    bool pending = p->pending;
+    equeue_mutex_unlock(&p->lock);
+
+    if (!pending || !p->size) {
+        equeue_parallel_run(p, pending ? 0 : p->result);
+    } else if (ws[g->count]) {
+        equeue_parallel_run(p, ws[g->count] + 1);
+    }
+
+    if (ws[g->count]) {
+        equeue_dealloc(g->queues[0], ws[g->count]);
+    }
+
+    // cancel workers that never started, we may be blocking their queue
+    for (unsigned i = 0; i < g->count; i++) {
+        equeue_cancel(g->queues[i], ids[i]);
+    }
+
+    while (1) {
+        equeue_mutex_lock(&p->lock);
+        pending = p->pending;
+        equeue_mutex_unlock(&p->lock);
+
+        if (!pending) {
+            break;
+        }
+
+        equeue_sema_wait(&p->done, -1);
+    }
+
+    equeue_sema_destroy(&p->done);
+    equeue_mutex_destroy(&p->lock);
+    return 0;
+}
+
+int equeue_parallel_for(equeue_group_t *g,
+        size_t begin, size_t end, size_t grain,
+        void (*fn)(void *data, size_t begin, size_t end), void *data) {
+    struct equeue_parallel p = {
+        .next = begin,
+        .end = end,
+        .grain = grain,
+        .fn = fn,
+        .data = data,
+    };
+
+    return equeue_parallel(g, &p);
+}
 
-    equeue_background(q, equeue_chain_update, c);
+int equeue_parallel_reduce(equeue_group_t *g,
+        size_t begin, size_t end, size_t grain,
+        void (*map)(void *data, size_t begin, size_t end, void *acc),
+        void (*combine)(void *data, void *result, const void *acc),
+        void *data, void *result, const void *identity, size_t size) {
+    struct equeue_parallel p = {
+        .next = begin,
+        .end = end,
+        .grain = grain,
+        .map = map,
+        .combine = combine,
+        .data = data,
+        .result = result,
+        .identity = identity,
+        .size = size,
+    };
+
+    return equeue_parallel(g, &p);
 }
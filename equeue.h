@@ -16,6 +16,14 @@ extern "C" {
 
 #include <stddef.h>
 #include <stdint.h>
+#if defined(EQUEUE_TRACE) || defined(EQUEUE_PROFILE)
+#include <stdio.h>
+#endif
+#if defined(EQUEUE_PLATFORM_POSIX) && defined(__linux__)
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#endif
 
 
 // The minimum size of an event
@@ -27,6 +35,9 @@ struct equeue_event {
     unsigned size;
     uint8_t id;
     uint8_t generation;
+#ifdef EQUEUE_COMPACT
+    uint16_t handle;
+#endif
 
     struct equeue_event *next;
     struct equeue_event *sibling;
@@ -40,6 +51,89 @@ struct equeue_event {
     // data follows
 };
 
+#ifdef EQUEUE_TRACE
+// Trace record types
+//
+// When compiled with EQUEUE_TRACE, the event queue reports its activity to
+// an optional trace hook. Each record only fills in the relevant fields.
+//
+// EQUEUE_TRACE_POST   - Event posted, with id, cb, size, delay, and period
+// EQUEUE_TRACE_CANCEL - Cancel requested, with id
+// EQUEUE_TRACE_BATCH  - Batch of events dequeued for dispatch, with count
+// EQUEUE_TRACE_CALL   - Callback about to execute, with id and cb
+// EQUEUE_TRACE_RETURN - Callback returned, with id and cb
+// EQUEUE_TRACE_SLEEP  - Dispatch loop going to sleep, with delay
+// EQUEUE_TRACE_WAKE   - Dispatch loop woke up
+// EQUEUE_TRACE_NOMEM  - Allocation failed, with size
+enum equeue_trace_type {
+    EQUEUE_TRACE_POST,
+    EQUEUE_TRACE_CANCEL,
+    EQUEUE_TRACE_BATCH,
+    EQUEUE_TRACE_CALL,
+    EQUEUE_TRACE_RETURN,
+    EQUEUE_TRACE_SLEEP,
+    EQUEUE_TRACE_WAKE,
+    EQUEUE_TRACE_NOMEM,
+};
+
+// Trace record
+//
+// The callback of events created by equeue_call is reported as the
+// user's callback rather than the internal trampoline.
+struct equeue_trace_record {
+    struct equeue *queue;
+    int type;
+    int id;
+    void (*cb)(void *);
+    unsigned size;
+    unsigned count;
+    int delay;
+    int period;
+};
+#endif
+
+// Operation log format
+//
+// Logs written by equeue_trace_log start with the EQUEUE_LOG_MAGIC header,
+// followed by one record per post or cancel in host byte order. Times are
+// in microseconds and wrap, so only differences between records are
+// meaningful. Sizes are the payload sizes of the allocated chunks, which
+// may be rounded up from the requested size.
+#define EQUEUE_LOG_MAGIC "eqlog01"
+
+enum equeue_log_type {
+    EQUEUE_LOG_POST,
+    EQUEUE_LOG_CANCEL,
+};
+
+struct equeue_log_record {
+    uint32_t time;
+    uint32_t type;
+    int32_t id;
+    uint32_t size;
+    int32_t delay;
+    int32_t period;
+};
+
+#ifdef EQUEUE_PROFILE
+// Number of callbacks tracked by the per-callback profiler
+#ifndef EQUEUE_PROFILE_SIZE
+#define EQUEUE_PROFILE_SIZE 32
+#endif
+
+// Per-callback statistics
+//
+// Runtimes are measured in microseconds with equeue_utick. Lateness is the
+// time in milliseconds between an event's target and its callback starting.
+struct equeue_profile {
+    void (*cb)(void *);
+    unsigned calls;
+    unsigned max_runtime;
+    uint64_t runtime;
+    uint64_t lateness;
+};
+#endif
+
 // Event queue structure
 typedef struct equeue {
     struct equeue_event *queue;
@@ -63,6 +157,43 @@ typedef struct equeue {
         void *timer;
     } background;
 
+    struct equeue_moderation {
+        int window;
+        bool armed;
+    } moderation;
+    bool single;
+
+#ifdef EQUEUE_COMPACT
+    struct equeue_handles {
+        uintptr_t *slots;
+        unsigned count;
+        unsigned free;
+    } handles;
+#endif
+
+#ifdef EQUEUE_TRACE
+    struct equeue_tracer {
+        void (*hook)(void *data, const struct equeue_trace_record *record);
+        void *data;
+    } tracer;
+#endif
+
+#ifdef EQUEUE_PROFILE
+    struct equeue_profiler {
+        struct equeue_profile entries[EQUEUE_PROFILE_SIZE];
+        unsigned untracked;
+    } profiler;
+#endif
+
+#ifdef EQUEUE_WATCHDOG
+    struct equeue_watch {
+        volatile unsigned seq;
+        volatile unsigned start;
+        void (*volatile cb)(void *);
+        volatile int id;
+    } watch;
+#endif
+
     equeue_sema_t eventsema;
     equeue_mutex_t queuelock;
     equeue_mutex_t memlock;
@@ -137,6 +268,23 @@ int equeue_call_every(equeue_t *queue, int ms, void (*cb)(void *), void *data);
 void *equeue_alloc(equeue_t *queue, size_t size);
 void equeue_dealloc(equeue_t *queue, void *event);
 
+// Resize an event that has not been posted
+//
+// Changes the size of an event allocated by equeue_alloc, keeping its
+// contents up to the smaller of the two sizes as well as its delay, period
+// and destructor. An event shrinks in place, with the unused tail returned
+// to the allocator, and grows in place if its chunk already has the room or
+// it is the most recently carved chunk. Otherwise the event is moved to a
+// new chunk. This allows events to be allocated optimistically small when
+// the final size is only known once the payload has been written.
+//
+// The equeue_realloc function is irq safe.
+//
+// The equeue_realloc function returns a pointer to the resized event, which
+// may differ from the original. If there is not enough memory, equeue_realloc
+// returns null and the original event is left unchanged.
+void *equeue_realloc(equeue_t *queue, void *event, size_t size);
+
 // Configure an allocated event
 //
 // equeue_event_delay  - Millisecond delay before dispatching an event
@@ -160,6 +308,18 @@ void equeue_event_dtor(void *event, void (*dtor)(void *));
 // be passed to equeue_cancel.
 int equeue_post(equeue_t *queue, void (*cb)(void *), void *event);
 
+// Post a batch of events onto the event queue
+//
+// Posts each of count events allocated by equeue_alloc with the same
+// callback, as if by equeue_post, but locks the queue and signals the
+// dispatch loop only once for the whole batch. Events in a batch with the
+// same delay are dispatched in the order given. If ids is not null, the
+// unique id of each event is written to the corresponding entry.
+//
+// The equeue_post_batch function is irq safe.
+void equeue_post_batch(equeue_t *queue, void (*cb)(void *),
+        void **events, unsigned count, int *ids);
+
 // Cancel an in-flight event
 //
 // Attempts to cancel an event referenced by the unique id returned from
@@ -173,11 +333,40 @@ int equeue_post(equeue_t *queue, void (*cb)(void *), void *event);
 // the event may have already begun executing.
 void equeue_cancel(equeue_t *queue, int id);
 
+// Moderate wakeups of the dispatch loop
+//
+// Every post normally signals the dispatch loop, which can cost a context
+// switch per event for high-rate producers. With moderation, a dispatch loop
+// that has just dispatched events sleeps for at most window milliseconds,
+// and posts made while a wakeup is due within the window do not signal it.
+// Events may then be dispatched up to window milliseconds late, in exchange
+// for one wakeup per window instead of one per post. The loop falls back to
+// signalled sleeps once a wakeup finds no work.
+//
+// A window of 0 disables moderation, which is the default.
+void equeue_moderate(equeue_t *queue, int window);
+
+// Use an event queue from a single thread
+//
+// A queue that is only ever used from the thread that dispatches it does
+// not need to synchronize. In single-threaded mode the queue skips its
+// locks, posts do not signal the dispatch loop, and the dispatch loop only
+// waits on its semaphore to sleep until the next deadline. Attached event
+// sources on Linux are still serviced, with a non-blocking poll when events
+// are already due.
+//
+// The mode must be set before the queue is shared, and the queue must then
+// not be used from any other thread or from interrupt and signal handlers.
+// The queue remains compatible with chaining and backgrounding as long as
+// everything runs on the same thread.
+void equeue_single_thread(equeue_t *queue, bool single);
+
 // Background an event queue onto a single-shot timer
 //
 // The provided update function will be called to indicate when the queue
 // should be dispatched. A negative timeout will be passed to the update
-// function when the timer is no longer needed.
+// function when the timer is no longer needed, either because dispatch left
+// the queue empty or because the update function is being replaced.
 //
 // Passing a null update function disables the existing timer.
 //
@@ -199,6 +388,405 @@ void equeue_background(equeue_t *queue,
 // the context of a dispatch loop while still being managed independently.
 void equeue_chain(equeue_t *queue, equeue_t *target);
 
+#ifdef EQUEUE_COMPACT
+// Compact an event queue's buffer
+//
+// When compiled with EQUEUE_COMPACT, event ids index a table of handles
+// instead of encoding an event's offset in the buffer, so pending events
+// can be moved without invalidating their ids. The table grows down from
+// the end of the buffer by a pointer for each chunk carved from the slab,
+// up to 65535 chunks.
+//
+// The equeue_compact function moves pending events from the top of the
+// used part of the buffer into free chunks further down, and returns the
+// free chunks left at the top to the slab, restoring contiguous space for
+// allocations of any size. Events that are allocated but not yet posted,
+// or that are currently being dispatched, are never moved and stop the
+// compaction at their position. Payloads of pending events must not hold
+// pointers into themselves.
+//
+// The equeue_compact function is thread safe and may be called from an
+// idle hook or from an event on the queue itself. The queue is only locked
+// for one chunk at a time, so other threads can post, cancel, and dispatch
+// between moves. Returns the number of bytes returned to the slab.
+size_t equeue_compact(equeue_t *queue);
+#endif
+
+#if defined(EQUEUE_PLATFORM_POSIX) && defined(__linux__)
+// Get a file descriptor that is readable while the queue needs dispatching
+//
+// The returned descriptor becomes readable when an event is posted or when
+// the next pending event is due, and stays readable until equeue_dispatch
+// is called with a timeout of 0. It can be added to an external poll,
+// select, or epoll loop, letting the loop dispatch the queue only when there
+// is work to do without a helper thread.
+//
+// The descriptor backgrounds the queue, replacing any existing background
+// timer or chain. Calling equeue_fd again returns the same descriptor.
+// Returns a negative value on failure.
+//
+// equeue_fd_close releases the descriptor and unbackgrounds the queue, and
+// must be called before the queue is destroyed. Only available on Linux.
+int equeue_fd(equeue_t *queue);
+void equeue_fd_close(equeue_t *queue);
+
+// Linux event sources
+//
+// A source attaches a signalfd, pidfd, or inotify descriptor to the wait of
+// an event queue, so the thread blocked in equeue_dispatch also wakes for
+// signals, child exits, and file changes. Each record read from the
+// descriptor is placed in an event allocated from the queue's buffer and
+// posted, and the callback is later dispatched with the record:
+//
+// equeue_source_signal  - A struct signalfd_siginfo for each signal in mask,
+//                         the signals must be blocked in every thread
+// equeue_source_child   - A siginfo_t once the child process pid exits, the
+//                         child is reaped
+// equeue_source_inotify - A struct inotify_event for each change to path
+//                         matching mask
+// equeue_source_recv    - A struct equeue_datagram for each datagram of up
+//                         to size bytes received on sock, the datagrams are
+//                         received with recvmmsg directly into their events
+//                         and each batch is posted with equeue_post_batch
+//
+// The socket given to equeue_source_recv is duplicated, so the caller keeps
+// ownership of its descriptor. Datagrams larger than size are truncated and
+// have MSG_TRUNC set in their flags.
+//
+// Records are only read while the queue waits in equeue_dispatch. Records
+// that arrive when the queue's buffer is exhausted are read and counted in
+// dropped instead of being retried. Sources are stored in the provided
+// equeue_source_t, and equeue_source_destroy must be called from the
+// dispatching thread or while the queue is not dispatching. Returns a
+// negative error code on failure.
+//
+// Events already posted by a source refer to its equeue_source_t, so the
+// struct must outlive them. After equeue_source_destroy, dispatch the
+// queue or destroy it before releasing the source's storage.
+struct signalfd_siginfo;
+struct inotify_event;
+struct equeue_datagram;
+
+typedef struct equeue_source {
+    struct equeue_sema_source source;
+    equeue_t *queue;
+    union {
+        void (*signal)(void *data, struct signalfd_siginfo *info);
+        void (*child)(void *data, siginfo_t *info);
+        void (*inotify)(void *data, struct inotify_event *event);
+        void (*recv)(void *data, struct equeue_datagram *datagram);
+    } cb;
+    void *data;
+    unsigned dropped;
+    size_t size;
+} equeue_source_t;
+
+struct equeue_datagram {
+    size_t size;
+    int flags;
+    socklen_t addrlen;
+    struct sockaddr_storage addr;
+    unsigned char data[];
+};
+
+int equeue_source_signal(equeue_source_t *source, equeue_t *queue,
+        const sigset_t *mask,
+        void (*cb)(void *data, struct signalfd_siginfo *info), void *data);
+int equeue_source_child(equeue_source_t *source, equeue_t *queue, pid_t pid,
+        void (*cb)(void *data, siginfo_t *info), void *data);
+int equeue_source_inotify(equeue_source_t *source, equeue_t *queue,
+        const char *path, uint32_t mask,
+        void (*cb)(void *data, struct inotify_event *event), void *data);
+int equeue_source_recv(equeue_source_t *source, equeue_t *queue, int sock,
+        size_t size,
+        void (*cb)(void *data, struct equeue_datagram *datagram), void *data);
+void equeue_source_destroy(equeue_source_t *source);
+#endif
+
+#ifdef EQUEUE_TRACE
+// Trace an event queue's activity
+//
+// The provided hook is called synchronously at each trace point with a
+// record describing the activity. The hook may be called from any context
+// that uses the event queue, including interrupts, and must not call back
+// into the event queue.
+//
+// Passing a null hook disables tracing. Only available when compiled
+// with EQUEUE_TRACE.
+void equeue_trace(equeue_t *queue,
+        void (*hook)(void *data, const struct equeue_trace_record *record),
+        void *data);
+
+// Record an event queue's activity in the Chrome trace format
+//
+// Installs a trace hook that writes each record to the provided file as
+// Chrome Trace Event JSON, which can be opened in chrome://tracing or the
+// Perfetto UI. Callbacks are shown as spans named after their symbol, as
+// resolved by dladdr, which requires exported symbols (-rdynamic) to
+// resolve functions outside of shared libraries. Sleeps of the dispatch
+// loop are shown as spans, and posts, cancels, dequeued batches, and
+// allocation failures as instant events.
+//
+// The closing bracket of the JSON array is optional in the format and is
+// never written, so the file can be opened while recording. Only available
+// on posix platforms when compiled with EQUEUE_TRACE.
+//
+// Returns a negative error code if the file could not be written.
+int equeue_trace_chrome(equeue_t *queue, FILE *file);
+
+// Record an event queue's posts and cancels as a binary operation log
+//
+// Installs a trace hook that appends a struct equeue_log_record to the
+// provided file for each post and cancel, see the operation log format
+// above. The log can be re-executed against a fresh event queue with the
+// replay tool in tests/replay.c. Only available on posix platforms when
+// compiled with EQUEUE_TRACE.
+//
+// Returns a negative error code if the file could not be written.
+int equeue_trace_log(equeue_t *queue, FILE *file);
+#endif
+
+#ifdef EQUEUE_PROFILE
+// Profile the callbacks executed by an event queue
+//
+// When compiled with EQUEUE_PROFILE, equeue_dispatch keeps statistics for
+// each callback in a fixed-size hash table keyed by the callback's function
+// pointer, see struct equeue_profile. Events created by equeue_call are
+// attributed to the user's callback. Calls to callbacks that do not fit in
+// the table are only counted in profiler.untracked.
+//
+// The table is updated by the dispatch loop without locking, so the
+// equeue_profile functions should be called from the dispatch loop or
+// while it is not running.
+//
+// equeue_profile_reset - Clear the statistics
+// equeue_profile_dump  - Write the statistics to a file, sorted by total
+//                        runtime, with callbacks resolved by dladdr. Only
+//                        available on posix platforms.
+void equeue_profile_reset(equeue_t *queue);
+void equeue_profile_dump(equeue_t *queue, FILE *file);
+#endif
+
+#ifdef EQUEUE_WATCHDOG
+// Slow callback report
+//
+// The duration is the time in milliseconds the callback had been running
+// when the watchdog noticed it, so it is a lower bound on the overrun.
+struct equeue_overrun {
+    struct equeue *queue;
+    void (*cb)(void *);
+    int id;
+    int duration;
+};
+
+// Watchdog structure
+typedef struct equeue_watchdog {
+    equeue_t *queue;
+    int threshold;
+    void (*hook)(void *data, const struct equeue_overrun *overrun);
+    void *data;
+    unsigned reported;
+
+#ifdef EQUEUE_PLATFORM_POSIX
+    pthread_t thread;
+    equeue_sema_t stop;
+#endif
+} equeue_watchdog_t;
+
+// Watch an event queue for slow callbacks
+//
+// When compiled with EQUEUE_WATCHDOG, equeue_dispatch publishes the callback,
+// event id and start time of the callback it is running. This costs a read
+// of the tick and a handful of stores per callback, and nothing else on the
+// dispatch path.
+//
+// A watchdog polls this state with equeue_watchdog_check, and calls the hook
+// once for every callback that runs for longer than the threshold in
+// milliseconds. Events created by equeue_call are reported with the user's
+// callback. The hook runs in the context of the caller of
+// equeue_watchdog_check and may run while the slow callback is still
+// executing, for example to signal the dispatch thread for a stack trace.
+//
+// The published state is read without locking and checked against a
+// sequence count. On platforms with weakly ordered memory a report may
+// rarely pair a callback with the wrong start time, the watchdog is a
+// diagnostic and does not affect dispatch.
+//
+// equeue_watchdog_create - Attach a watchdog to a queue
+// equeue_watchdog_check  - Poll the queue, returns 1 if the hook was called
+// equeue_watchdog_start  - Poll from a background thread every threshold/2
+//                          ms until stopped, only available on posix
+// equeue_watchdog_stop   - Stop and join the background thread
+void equeue_watchdog_create(equeue_watchdog_t *watchdog, equeue_t *queue,
+        int threshold,
+        void (*hook)(void *data, const struct equeue_overrun *overrun),
+        void *data);
+int equeue_watchdog_check(equeue_watchdog_t *watchdog);
+#ifdef EQUEUE_PLATFORM_POSIX
+int equeue_watchdog_start(equeue_watchdog_t *watchdog);
+void equeue_watchdog_stop(equeue_watchdog_t *watchdog);
+#endif
+#endif
+
+// Bounded message channels
+//
+// A channel is a fixed-capacity ring of equally sized messages stored in an
+// event queue's buffer. Producers copy messages into the channel with
+// equeue_chan_send without allocating an event per message. The first
+// message sent to an empty channel posts a single delivery event, and when
+// it is dispatched the callback receives every message that has accumulated
+// since, in at most two contiguous batches. Messages sent while the callback
+// runs are delivered by a follow-up event.
+//
+// The message size should be the sizeof the message type so that messages
+// in a batch are correctly aligned.
+//
+// The equeue_chan_create function returns a negative error code if the
+// ring could not be allocated. The equeue_chan_destroy function must not
+// be called while the callback is executing.
+//
+// The equeue_chan_send function is irq safe and returns 0 on success, or a
+// negative value if the channel is full or the delivery event could not be
+// allocated, in which case the message is not sent.
+typedef struct equeue_chan {
+    equeue_t *queue;
+    unsigned char *buffer;
+    size_t size;
+    unsigned capacity;
+    unsigned head;
+    unsigned count;
+    int id;
+
+    void (*cb)(void *data, void *msgs, unsigned count);
+    void *data;
+
+    equeue_mutex_t lock;
+} equeue_chan_t;
+
+int equeue_chan_create(equeue_chan_t *chan, equeue_t *queue,
+        size_t size, unsigned capacity,
+        void (*cb)(void *data, void *msgs, unsigned count), void *data);
+void equeue_chan_destroy(equeue_chan_t *chan);
+int equeue_chan_send(equeue_chan_t *chan, const void *msg);
+
+// Publish-subscribe topics
+//
+// A topic multicasts a payload to every subscribed event queue without
+// copying it. Payloads are allocated once with equeue_topic_alloc out of an
+// arena, which is any event queue used purely for its allocator. Publishing
+// posts a small delivery event referencing the payload to each subscriber's
+// queue, and the payload is returned to the arena after the last delivery
+// event has been dispatched or cancelled. Subscribers must treat the
+// payload as read-only.
+//
+// The equeue_topic_subscribe function returns a handle that can be passed
+// to equeue_topic_unsubscribe, or null if the subscription could not be
+// allocated. Deliveries that are already in-flight still execute after
+// unsubscribing.
+//
+// The equeue_topic_alloc function returns null if the arena is out of
+// memory. A payload that is not published must be freed with
+// equeue_topic_dealloc. The equeue_topic_publish function consumes the
+// payload and returns the number of subscribers it was posted to, queues
+// that are out of memory miss the delivery.
+//
+// A topic must not be destroyed while deliveries are in-flight.
+typedef struct equeue_topic {
+    equeue_t *arena;
+    struct equeue_topic_sub *subs;
+    equeue_mutex_t lock;
+} equeue_topic_t;
+
+int equeue_topic_create(equeue_topic_t *topic, equeue_t *arena);
+void equeue_topic_destroy(equeue_topic_t *topic);
+void *equeue_topic_subscribe(equeue_topic_t *topic, equeue_t *queue,
+        void (*cb)(void *data, const void *payload), void *data);
+void equeue_topic_unsubscribe(equeue_topic_t *topic, void *sub);
+void *equeue_topic_alloc(equeue_topic_t *topic, size_t size);
+void equeue_topic_dealloc(equeue_topic_t *topic, void *payload);
+int equeue_topic_publish(equeue_topic_t *topic, void *payload);
+
+// Reference-counted external payloads
+//
+// Large payloads can be kept outside of the event queue's buffer and shared
+// between events without copying. An equeue_buf_t describes an externally
+// owned payload along with a release function, which is called once the
+// last reference is dropped. The creator holds the first reference.
+//
+// The equeue_buf_call function posts a small event to a queue that passes
+// the payload to the callback after an optional delay in milliseconds. The
+// event holds its own reference, which is dropped through the event's
+// destructor after it has been dispatched or cancelled, so the same payload
+// can be posted to any number of queues. Callbacks must treat the payload
+// as read-only. Custom events can hold a reference as well by calling
+// equeue_buf_retain and releasing it from their destructor.
+//
+// The equeue_buf_create function returns a negative error code if the
+// reference count's lock could not be created. The equeue_buf_call function
+// returns the unique id of the posted event, or 0 if there is not enough
+// memory, in which case no reference is taken.
+//
+// The equeue_buf_retain, equeue_buf_release and equeue_buf_call functions
+// are irq safe, the release function runs in the context of whoever drops
+// the last reference.
+typedef struct equeue_buf {
+    const void *payload;
+    size_t size;
+    unsigned refs;
+
+    void (*release)(void *data, const void *payload);
+    void *data;
+
+    equeue_mutex_t lock;
+} equeue_buf_t;
+
+int equeue_buf_create(equeue_buf_t *buf, const void *payload, size_t size,
+        void (*release)(void *data, const void *payload), void *data);
+void equeue_buf_retain(equeue_buf_t *buf);
+void equeue_buf_release(equeue_buf_t *buf);
+int equeue_buf_call(equeue_buf_t *buf, equeue_t *queue, int ms,
+        void (*cb)(void *data, const void *payload, size_t size), void *data);
+
+// Group of event queues
+//
+// A group is simply an array of event queues, usually one per core with
+// each queue dispatched from its own thread. Groups are used to spread bulk
+// work across existing dispatch loops.
+typedef struct equeue_group {
+    equeue_t **queues;
+    unsigned count;
+} equeue_group_t;
+
+// Parallel loops over a group of event queues
+//
+// The equeue_parallel_for function splits the range [begin, end) into
+// chunks of at most grain iterations and calls fn on each chunk. A worker
+// event is posted to every queue in the group, and workers claim chunks
+// from a shared cursor until the range is exhausted, so idle queues steal
+// the chunks that busy queues have not gotten to. The calling thread
+// participates as well, and workers that have not started by the time the
+// range is exhausted are cancelled.
+//
+// The equeue_parallel_reduce function also gives each participant a
+// private accumulator of the specified size, initialized as a copy of
+// identity, or zeroed if identity is null. Chunks are folded into the
+// accumulator with map, and after its participant has finished, each
+// accumulator that received chunks is folded into result with combine.
+// The initial value of result is counted exactly once. Calls to combine
+// are serialized.
+//
+// Both functions block until every chunk has been executed. They may be
+// called from the dispatch loop of a queue in the group. On error, the
+// equeue_parallel functions return a negative, platform-specific error code.
+int equeue_parallel_for(equeue_group_t *group,
+        size_t begin, size_t end, size_t grain,
+        void (*fn)(void *data, size_t begin, size_t end), void *data);
+int equeue_parallel_reduce(equeue_group_t *group,
+        size_t begin, size_t end, size_t grain,
+        void (*map)(void *data, size_t begin, size_t end, void *acc),
+        void (*combine)(void *data, void *result, const void *acc),
+        void *data, void *result, const void *identity, size_t size);
+
 
 #ifdef __cplusplus
 }
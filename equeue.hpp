@@ -0,0 +1,766 @@
+/*
+ * C++ interface for the equeue library
+ *
+ * Copyright (c) 2016 Christopher Haster
+ * Distributed under the MIT license
+ */
+#ifndef EQUEUE_HPP
+#define EQUEUE_HPP
+
+#include "equeue.h"
+
+#include <new>
+#include <array>
+#include <tuple>
+#include <utility>
+#include <exception>
+#include <stdexcept>
+#include <type_traits>
+#include <cstddef>
+#include <cstdint>
+
+#if __cplusplus >= 201703L && __has_include(<memory_resource>)
+#include <memory_resource>
+#define EQUEUE_HAS_PMR
+#endif
+
+
+// The C++ interface lives in the events namespace, the equeue name is
+// already taken by the struct equeue tag of the C interface
+namespace events {
+
+namespace detail {
+
+// compile-time maximum of a list of sizes
+constexpr size_t max_size(size_t a) {
+    return a;
+}
+
+template <typename... Ts>
+constexpr size_t max_size(size_t a, size_t b, Ts... cs) {
+    return max_size(a > b ? a : b, cs...);
+}
+
+// size of a chunk in the equeue allocator, matches equeue_mem_alloc
+constexpr size_t chunk_size(size_t size) {
+    return (sizeof(struct equeue_event) + size + sizeof(void*)-1)
+            & ~(sizeof(void*)-1);
+}
+
+// buffer used by each chunk, including its handle when compacting
+constexpr size_t chunk_footprint(size_t size) {
+#ifdef EQUEUE_COMPACT
+    return chunk_size(size) + sizeof(uintptr_t);
+#else
+    return chunk_size(size);
+#endif
+}
+
+// destructor thunk for events holding a T
+template <typename T>
+void event_dtor(void *p) {
+    static_cast<T *>(p)->~T();
+}
+
+// only register a destructor if there is something to destroy, events
+// are allocated without a destructor
+template <typename T>
+void event_set_dtor(T *, std::true_type) {
+}
+
+template <typename T>
+void event_set_dtor(T *e, std::false_type) {
+    equeue_event_dtor(e, event_dtor<T>);
+}
+
+template <typename T>
+void event_set_dtor(T *e) {
+    event_set_dtor(e, typename std::is_trivially_destructible<T>::type());
+}
+
+// payload of simple callbacks, same layout as equeue_call
+struct call {
+    void (*cb)(void *);
+    void *data;
+};
+
+inline void call_dispatch(void *p) {
+    call *c = static_cast<call *>(p);
+    c->cb(c->data);
+}
+
+}
+
+
+// Callable events
+//
+// A callable_event<T> stores a callable of type T inline in an event
+// allocated out of a queue's buffer and invokes it through a static thunk
+// specific to T, so there is no virtual dispatch or heap allocation as
+// with std::function. Move-only callables are supported.
+//
+// The destructor is selected at compile time. Trivially destructible
+// callables, such as lambdas capturing pointers, register no destructor and
+// skip the destructor call on dispatch and cancel. Otherwise the callable
+// is destroyed after it executes or when the event is cancelled.
+//
+// The create function returns null if the queue is out of memory, a
+// created event can be configured with the equeue_event functions before
+// being posted. If the callable's constructor throws, the event is
+// deallocated and the exception propagates.
+template <typename T>
+struct callable_event {
+    static_assert(alignof(T) <= alignof(void*),
+            "callable is overaligned for the equeue allocator");
+
+    template <typename F>
+    static T *create(equeue_t *q, F &&f, size_t size = sizeof(T)) {
+        void *p = equeue_alloc(q, size);
+        if (!p) {
+            return 0;
+        }
+
+        T *e;
+        try {
+            e = new (p) T(std::forward<F>(f));
+        } catch (...) {
+            equeue_dealloc(q, p);
+            throw;
+        }
+
+        detail::event_set_dtor(e);
+        return e;
+    }
+
+    static int post(equeue_t *q, T *e) {
+        return equeue_post(q, &callable_event::dispatch, e);
+    }
+
+    static void dispatch(void *p) {
+        (*static_cast<T *>(p))();
+    }
+};
+
+// Post a callable, see equeue_call
+//
+// Returns the event's id, or 0 if the queue is out of memory.
+template <typename F>
+int call(equeue_t *q, F &&f) {
+    typedef callable_event<typename std::decay<F>::type> event;
+    auto *e = event::create(q, std::forward<F>(f));
+    return e ? event::post(q, e) : 0;
+}
+
+template <typename F>
+int call_in(equeue_t *q, int ms, F &&f) {
+    typedef callable_event<typename std::decay<F>::type> event;
+    auto *e = event::create(q, std::forward<F>(f));
+    if (!e) {
+        return 0;
+    }
+
+    equeue_event_delay(e, ms);
+    return event::post(q, e);
+}
+
+template <typename F>
+int call_every(equeue_t *q, int ms, F &&f) {
+    typedef callable_event<typename std::decay<F>::type> event;
+    auto *e = event::create(q, std::forward<F>(f));
+    if (!e) {
+        return 0;
+    }
+
+    equeue_event_delay(e, ms);
+    equeue_event_period(e, ms);
+    return event::post(q, e);
+}
+
+
+// Statically sized event queue
+//
+// The static_queue owns a buffer sized at compile time to hold MaxEvents
+// events of any of the listed payload types, and creates the underlying
+// equeue in place so no heap is used. Every allocation is rounded up to the
+// largest payload, so the allocator never fragments and MaxEvents events
+// can always be pending at once, regardless of which types are posted.
+//
+// Simple callbacks from call, call_in, and call_every always fit. Payloads
+// that are too large or overaligned for the buffer are rejected at compile
+// time by alloc. The constructor throws std::runtime_error if the queue's
+// platform resources cannot be created.
+template <unsigned MaxEvents, typename... Ts>
+class static_queue {
+public:
+    static constexpr size_t payload_size = detail::max_size(
+            sizeof(detail::call), sizeof(Ts)...);
+    static constexpr size_t event_size = detail::chunk_size(payload_size);
+    static constexpr size_t buffer_size =
+            MaxEvents * detail::chunk_footprint(payload_size);
+
+    static_assert(MaxEvents > 0, "static_queue must hold at least one event");
+
+    static_queue() {
+        int err = equeue_create_inplace(&_equeue, buffer_size, _buffer);
+        if (err) {
+            throw std::runtime_error("static_queue: failed to create equeue");
+        }
+    }
+
+    ~static_queue() {
+        equeue_destroy(&_equeue);
+    }
+
+    static_queue(const static_queue &) = delete;
+    static_queue &operator=(const static_queue &) = delete;
+
+    // Underlying equeue for use with the C interface
+    equeue_t *get() {
+        return &_equeue;
+    }
+
+    // Dispatch events, see equeue_dispatch
+    void dispatch(int ms = -1) {
+        equeue_dispatch(&_equeue, ms);
+    }
+
+    // Break out of a running event loop, see equeue_break
+    void break_dispatch() {
+        equeue_break(&_equeue);
+    }
+
+    // Cancel an in-flight event, see equeue_cancel
+    void cancel(int id) {
+        equeue_cancel(&_equeue, id);
+    }
+
+    // Simple event calls, see equeue_call
+    int call(void (*cb)(void *), void *data) {
+        return call_in(-1, cb, data);
+    }
+
+    int call_in(int ms, void (*cb)(void *), void *data) {
+        detail::call *c = alloc<detail::call>();
+        if (!c) {
+            return 0;
+        }
+
+        c->cb = cb;
+        c->data = data;
+        if (ms >= 0) {
+            equeue_event_delay(c, ms);
+        }
+        return post(detail::call_dispatch, c);
+    }
+
+    int call_every(int ms, void (*cb)(void *), void *data) {
+        detail::call *c = alloc<detail::call>();
+        if (!c) {
+            return 0;
+        }
+
+        c->cb = cb;
+        c->data = data;
+        equeue_event_delay(c, ms);
+        equeue_event_period(c, ms);
+        return post(detail::call_dispatch, c);
+    }
+
+    // Callable event calls, see callable_event
+    template <typename F>
+    int call(F &&f) {
+        return call_in(-1, std::forward<F>(f));
+    }
+
+    template <typename F>
+    int call_in(int ms, F &&f) {
+        typedef typename std::decay<F>::type T;
+        T *e = create<T>(std::forward<F>(f));
+        if (!e) {
+            return 0;
+        }
+
+        if (ms >= 0) {
+            equeue_event_delay(e, ms);
+        }
+        return callable_event<T>::post(&_equeue, e);
+    }
+
+    template <typename F>
+    int call_every(int ms, F &&f) {
+        typedef typename std::decay<F>::type T;
+        T *e = create<T>(std::forward<F>(f));
+        if (!e) {
+            return 0;
+        }
+
+        equeue_event_delay(e, ms);
+        equeue_event_period(e, ms);
+        return callable_event<T>::post(&_equeue, e);
+    }
+
+    // Allocate and construct an event holding a T
+    //
+    // The T is destroyed when the event is deallocated. Returns null if
+    // MaxEvents events are already allocated. If T's constructor throws,
+    // the slot is released and the exception propagates.
+    template <typename T, typename... Args>
+    T *alloc(Args &&...args) {
+        static_assert(sizeof(T) <= payload_size,
+                "event type does not fit in this static_queue, "
+                "add it to the list of event types");
+        static_assert(alignof(T) <= alignof(void*),
+                "event type is overaligned for the equeue allocator");
+
+        void *p = equeue_alloc(&_equeue, payload_size);
+        if (!p) {
+            return 0;
+        }
+
+        T *e;
+        try {
+            e = new (p) T(std::forward<Args>(args)...);
+        } catch (...) {
+            equeue_dealloc(&_equeue, p);
+            throw;
+        }
+
+        detail::event_set_dtor(e);
+        return e;
+    }
+
+    // Deallocate an event that has not been posted, see equeue_dealloc
+    template <typename T>
+    void dealloc(T *e) {
+        equeue_dealloc(&_equeue, e);
+    }
+
+    // Post an allocated event, see equeue_post
+    template <typename T>
+    int post(void (*cb)(void *), T *e) {
+        return equeue_post(&_equeue, cb, e);
+    }
+
+private:
+    template <typename T, typename F>
+    T *create(F &&f) {
+        static_assert(sizeof(T) <= payload_size,
+                "callable does not fit in this static_queue, "
+                "add it to the list of event types");
+        return callable_event<T>::create(&_equeue,
+                std::forward<F>(f), payload_size);
+    }
+
+    equeue_t _equeue;
+    alignas(void*) unsigned char _buffer[buffer_size];
+};
+
+
+// Executor over an event queue
+//
+// The execute function posts the callable as a callable_event, so no
+// std::function or heap allocation is involved.
+//
+// The return value is the event's id, or 0 if the queue is out of memory.
+class executor {
+public:
+    explicit executor(equeue_t *q) : _q(q) {
+    }
+
+    template <typename F>
+    int execute(F &&f) const {
+        return events::call(_q, std::forward<F>(f));
+    }
+
+    equeue_t *get() const {
+        return _q;
+    }
+
+    bool operator==(const executor &other) const {
+        return _q == other._q;
+    }
+
+    bool operator!=(const executor &other) const {
+        return _q != other._q;
+    }
+
+private:
+    equeue_t *_q;
+};
+
+
+namespace detail {
+
+// operation state of a schedule sender, the operation state lives with
+// the caller and only the event that completes it is allocated in the
+// queue's buffer
+template <typename R>
+class schedule_operation {
+public:
+    schedule_operation(equeue_t *q, int ms, R &&r)
+        : _q(q), _ms(ms), _r(std::move(r)) {
+    }
+
+    schedule_operation(const schedule_operation &) = delete;
+    schedule_operation &operator=(const schedule_operation &) = delete;
+
+    void start() noexcept {
+        int id = equeue_call_in(_q, _ms, &schedule_operation::dispatch, this);
+        if (!id) {
+            std::move(_r).set_error(std::make_exception_ptr(std::bad_alloc()));
+        }
+    }
+
+private:
+    static void dispatch(void *p) {
+        schedule_operation *op = static_cast<schedule_operation *>(p);
+        try {
+            std::move(op->_r).set_value();
+        } catch (...) {
+            std::move(op->_r).set_error(std::current_exception());
+        }
+    }
+
+    equeue_t *_q;
+    int _ms;
+    R _r;
+};
+
+}
+
+// Sender returned by scheduler::schedule and scheduler::schedule_after
+//
+// Completes with set_value() from the queue's dispatch loop, or with
+// set_error(std::exception_ptr) if the queue is out of memory.
+class schedule_sender {
+public:
+    template <template <typename...> class Tuple,
+              template <typename...> class Variant>
+    using value_types = Variant<Tuple<>>;
+
+    template <template <typename...> class Variant>
+    using error_types = Variant<std::exception_ptr>;
+
+    static constexpr bool sends_done = false;
+
+    schedule_sender(equeue_t *q, int ms) : _q(q), _ms(ms) {
+    }
+
+    template <typename R>
+    detail::schedule_operation<typename std::decay<R>::type>
+    connect(R &&r) const {
+        return {_q, _ms, typename std::decay<R>::type(std::forward<R>(r))};
+    }
+
+private:
+    equeue_t *_q;
+    int _ms;
+};
+
+// Scheduler over an event queue
+//
+// Models the P2300 scheduler concept with member customizations in the
+// style of the reference implementations: schedule returns a sender that
+// completes on the queue's dispatch loop, and schedule_after does the same
+// after a delay in milliseconds. Receivers provide set_value, set_error,
+// and set_stopped members. The now function returns the queue's time base.
+class scheduler {
+public:
+    explicit scheduler(equeue_t *q) : _q(q) {
+    }
+
+    schedule_sender schedule() const {
+        return schedule_sender(_q, 0);
+    }
+
+    schedule_sender schedule_after(int ms) const {
+        return schedule_sender(_q, ms);
+    }
+
+    unsigned now() const {
+        return equeue_tick();
+    }
+
+    equeue_t *get() const {
+        return _q;
+    }
+
+    bool operator==(const scheduler &other) const {
+        return _q == other._q;
+    }
+
+    bool operator!=(const scheduler &other) const {
+        return _q != other._q;
+    }
+
+private:
+    equeue_t *_q;
+};
+
+
+namespace detail {
+
+// compile-time greatest common divisor and least common multiple
+constexpr unsigned gcd(unsigned a, unsigned b) {
+    while (b) {
+        unsigned t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+constexpr unsigned lcm(unsigned a, unsigned b) {
+    return a / gcd(a, b) * b;
+}
+
+// a frame of a cyclic executive, the tasks released at one instant of the
+// hyperperiod and the delay until the next frame
+struct cyclic_frame {
+    uint32_t tasks;
+    unsigned delay;
+};
+
+template <size_t N>
+constexpr unsigned cyclic_hyperperiod(const unsigned (&periods)[N]) {
+    unsigned h = 1;
+    for (size_t i = 0; i < N; i++) {
+        h = lcm(h, periods[i]);
+    }
+    return h;
+}
+
+// every release falls on a multiple of the gcd of all periods and offsets
+template <size_t N>
+constexpr unsigned cyclic_step(const unsigned (&periods)[N],
+        const unsigned (&offsets)[N]) {
+    unsigned g = 0;
+    for (size_t i = 0; i < N; i++) {
+        g = gcd(gcd(g, periods[i]), offsets[i]);
+    }
+    return g;
+}
+
+template <size_t N>
+constexpr uint32_t cyclic_mask(const unsigned (&periods)[N],
+        const unsigned (&offsets)[N], unsigned t) {
+    uint32_t mask = 0;
+    for (size_t i = 0; i < N; i++) {
+        if (t % periods[i] == offsets[i]) {
+            mask |= uint32_t(1) << i;
+        }
+    }
+    return mask;
+}
+
+template <size_t N>
+constexpr unsigned cyclic_count(const unsigned (&periods)[N],
+        const unsigned (&offsets)[N]) {
+    unsigned h = cyclic_hyperperiod(periods);
+    unsigned g = cyclic_step(periods, offsets);
+    unsigned count = 0;
+    for (unsigned t = 0; t < h; t += g) {
+        if (cyclic_mask(periods, offsets, t)) {
+            count += 1;
+        }
+    }
+    return count;
+}
+
+template <size_t M, size_t N>
+constexpr std::array<cyclic_frame, M> cyclic_frames(
+        const unsigned (&periods)[N], const unsigned (&offsets)[N]) {
+    unsigned h = cyclic_hyperperiod(periods);
+    unsigned g = cyclic_step(periods, offsets);
+
+    std::array<cyclic_frame, M> frames{};
+    std::array<unsigned, M> times{};
+    size_t i = 0;
+    for (unsigned t = 0; t < h; t += g) {
+        uint32_t mask = cyclic_mask(periods, offsets, t);
+        if (mask) {
+            frames[i].tasks = mask;
+            times[i] = t;
+            i += 1;
+        }
+    }
+
+    // the last frame wraps around to the first one of the next hyperperiod
+    for (i = 0; i < M; i++) {
+        frames[i].delay = (i+1 < M) ? times[i+1] - times[i]
+                : h - times[i] + times[0];
+    }
+    return frames;
+}
+
+}
+
+// Task of a cyclic executive
+//
+// Created with every<Period, Offset>(f), which releases the callable f every
+// Period milliseconds, Offset milliseconds into each period.
+template <unsigned Period, unsigned Offset, typename F>
+struct cyclic_task {
+    static_assert(Period > 0, "cyclic task needs a period");
+    static_assert(Offset < Period, "cyclic task offset must be in its period");
+
+    static constexpr unsigned period = Period;
+    static constexpr unsigned offset = Offset;
+    F f;
+};
+
+template <unsigned Period, unsigned Offset = 0, typename F>
+cyclic_task<Period, Offset, typename std::decay<F>::type> every(F &&f) {
+    return {std::forward<F>(f)};
+}
+
+// Cyclic executive for a static set of periodic tasks
+//
+// The hyperperiod of the tasks and a table of the frames in it, each frame
+// being an instant at which at least one task is released, are computed at
+// compile time. The executive runs as a single periodic event that executes
+// the tasks of the current frame and then sets its period to the delay until
+// the next frame, so the tasks need no scheduling of their own at runtime.
+// Tasks released in the same frame run in the order they are listed.
+//
+//     events::cyclic_executive exec(
+//             events::every<10>(control),
+//             events::every<50, 5>(telemetry));
+//     exec.start(&queue);
+//
+// The start function returns the id of the executive's event, which can be
+// passed to equeue_cancel, or 0 if the queue is out of memory. The executive
+// must outlive its event. At most 32 tasks are supported.
+template <typename... Tasks>
+class cyclic_executive {
+public:
+    static_assert(sizeof...(Tasks) > 0 && sizeof...(Tasks) <= 32,
+            "cyclic executive supports between 1 and 32 tasks");
+
+    static constexpr unsigned periods[sizeof...(Tasks)] = {Tasks::period...};
+    static constexpr unsigned offsets[sizeof...(Tasks)] = {Tasks::offset...};
+    static constexpr unsigned hyperperiod =
+            detail::cyclic_hyperperiod(periods);
+    static constexpr unsigned frame_count =
+            detail::cyclic_count(periods, offsets);
+    static constexpr std::array<detail::cyclic_frame, frame_count> frames =
+            detail::cyclic_frames<frame_count>(periods, offsets);
+
+    explicit cyclic_executive(Tasks... tasks) : _tasks(std::move(tasks)...) {
+    }
+
+    cyclic_executive(const cyclic_executive &) = delete;
+    cyclic_executive &operator=(const cyclic_executive &) = delete;
+
+    int start(equeue_t *q) {
+        cursor *c = static_cast<cursor *>(equeue_alloc(q, sizeof(cursor)));
+        if (!c) {
+            return 0;
+        }
+
+        c->exec = this;
+        c->frame = 0;
+        equeue_event_delay(c, start_delay());
+        equeue_event_period(c, frames[0].delay);
+        return equeue_post(q, &cyclic_executive::dispatch, c);
+    }
+
+private:
+    struct cursor {
+        cyclic_executive *exec;
+        unsigned frame;
+    };
+
+    static constexpr unsigned start_delay() {
+        unsigned start = offsets[0];
+        for (unsigned o : offsets) {
+            start = o < start ? o : start;
+        }
+        return start;
+    }
+
+    static void dispatch(void *p) {
+        cursor *c = static_cast<cursor *>(p);
+        const detail::cyclic_frame &f = frames[c->frame];
+        c->frame = (c->frame+1 < frame_count) ? c->frame+1 : 0;
+
+        // set before running the tasks so a task can cancel the executive
+        equeue_event_period(c, f.delay);
+        c->exec->run(f.tasks, std::index_sequence_for<Tasks...>());
+    }
+
+    template <size_t... I>
+    void run(uint32_t mask, std::index_sequence<I...>) {
+        ((mask & (uint32_t(1) << I) ? (void)std::get<I>(_tasks).f()
+                : (void)0), ...);
+    }
+
+    std::tuple<Tasks...> _tasks;
+};
+
+
+#ifdef EQUEUE_HAS_PMR
+// Polymorphic memory resource backed by an event queue's allocator
+//
+// Lets callbacks build std::pmr containers out of the same buffer as the
+// events themselves, so event-related memory never touches the global heap.
+// The equeue allocator only guarantees pointer alignment, overaligned
+// requests are over-allocated and aligned manually. As required of memory
+// resources, allocate throws std::bad_alloc if the queue is out of memory.
+//
+// Arbitrarily sized allocations void the capacity guarantee of a
+// static_queue, so a separate queue should be used as the resource.
+class memory_resource : public std::pmr::memory_resource {
+public:
+    explicit memory_resource(equeue_t *q) : _q(q) {
+    }
+
+    equeue_t *get() const {
+        return _q;
+    }
+
+private:
+    void *do_allocate(size_t bytes, size_t align) override {
+        if (align <= alignof(void*)) {
+            void *p = equeue_alloc(_q, bytes);
+            if (!p) {
+                throw std::bad_alloc();
+            }
+            return p;
+        }
+
+        // stash the original pointer in front of the aligned memory
+        void *p = equeue_alloc(_q, bytes + align);
+        if (!p) {
+            throw std::bad_alloc();
+        }
+
+        uintptr_t a = (reinterpret_cast<uintptr_t>(p) + sizeof(void*)
+                + align-1) & ~(uintptr_t)(align-1);
+        reinterpret_cast<void **>(a)[-1] = p;
+        return reinterpret_cast<void *>(a);
+    }
+
+    void do_deallocate(void *p, size_t bytes, size_t align) override {
+        if (align > alignof(void*)) {
+            p = static_cast<void **>(p)[-1];
+        }
+
+        equeue_dealloc(_q, p);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other)
+            const noexcept override {
+        const memory_resource *o = dynamic_cast<const memory_resource *>(
+                &other);
+        return o && o->_q == _q;
+    }
+
+    equeue_t *_q;
+};
+#endif
+
+}
+
+
+#endif
@@ -0,0 +1,17 @@
+/*
+ * Single translation unit build of the equeue library
+ *
+ * Copyright (c) 2016 Christopher Haster
+ * Distributed under the MIT license
+ */
+#define _GNU_SOURCE
+
+// Compiled instead of the individual sources when building with AMALG=1,
+// which lets the compiler inline the platform layer, such as the tick and
+// mutex operations, into equeue_post and equeue_dispatch
+#include "equeue_posix.c"
+#include "equeue_windows.c"
+#include "equeue_freertos.c"
+#include "equeue.c"
+#include "equeue_trace.c"
+#include "equeue_fd.c"
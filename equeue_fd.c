@@ -0,0 +1,328 @@
+/*
+ * Linux file descriptor integration for the equeue library
+ *
+ * Copyright (c) 2016 Christopher Haster
+ * Distributed under the MIT license
+ */
+#define _GNU_SOURCE
+#include "equeue.h"
+
+#if defined(EQUEUE_PLATFORM_POSIX) && defined(__linux__)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+#ifndef P_PIDFD
+#define P_PIDFD 3
+#endif
+
+#ifndef EQUEUE_SOURCE_BATCH
+#define EQUEUE_SOURCE_BATCH 16
+#endif
+
+
+// The queue is backgrounded onto an eventfd, signalled when an event is due
+// immediately, and a timerfd, armed for the next pending event. Both are
+// collected in an epoll instance so callers only watch a single descriptor,
+// which is readable as long as either of them is.
+struct equeue_fd_context {
+    int epoll;
+    int event;
+    int timer;
+};
+
+static void equeue_fd_update(void *p, int ms) {
+    struct equeue_fd_context *c = (struct equeue_fd_context *)p;
+
+    // called after every dispatch, so this is where readiness is consumed
+    uint64_t count;
+    while (read(c->event, &count, sizeof(count)) > 0);
+
+    // setting the timer also resets any expirations that were not read
+    struct itimerspec its = {{0, 0}, {0, 0}};
+    if (ms > 0) {
+        its.it_value.tv_sec = ms / 1000;
+        its.it_value.tv_nsec = (ms % 1000) * 1000000;
+    }
+    timerfd_settime(c->timer, 0, &its, 0);
+
+    if (ms == 0) {
+        count = 1;
+        write(c->event, &count, sizeof(count));
+    }
+}
+
+static void equeue_fd_release(struct equeue_fd_context *c) {
+    if (c->timer >= 0) {
+        close(c->timer);
+    }
+    if (c->event >= 0) {
+        close(c->event);
+    }
+    if (c->epoll >= 0) {
+        close(c->epoll);
+    }
+}
+
+int equeue_fd(equeue_t *q) {
+    if (q->background.update == equeue_fd_update) {
+        return ((struct equeue_fd_context *)q->background.timer)->epoll;
+    }
+
+    struct equeue_fd_context *c = equeue_alloc(q,
+            sizeof(struct equeue_fd_context));
+    if (!c) {
+        return -1;
+    }
+
+    c->epoll = epoll_create1(EPOLL_CLOEXEC);
+    c->event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    c->timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    struct epoll_event ev = {.events = EPOLLIN};
+    if (c->epoll < 0 || c->event < 0 || c->timer < 0 ||
+            epoll_ctl(c->epoll, EPOLL_CTL_ADD, c->event, &ev) ||
+            epoll_ctl(c->epoll, EPOLL_CTL_ADD, c->timer, &ev)) {
+        equeue_fd_release(c);
+        equeue_dealloc(q, c);
+        return -1;
+    }
+
+    // a chain keeps its context in the queue, unchaining releases it
+    equeue_chain(q, 0);
+    equeue_background(q, equeue_fd_update, c);
+    return c->epoll;
+}
+
+void equeue_fd_close(equeue_t *q) {
+    if (q->background.update != equeue_fd_update) {
+        return;
+    }
+
+    struct equeue_fd_context *c =
+            (struct equeue_fd_context *)q->background.timer;
+    equeue_background(q, 0, 0);
+    equeue_fd_release(c);
+    equeue_dealloc(q, c);
+}
+
+
+// Event sources, each record is copied into the payload of its own event
+// behind a pointer to the source
+struct equeue_source_event {
+    equeue_source_t *source;
+    uint64_t record[];
+};
+
+static void equeue_source_signal_dispatch(void *p) {
+    struct equeue_source_event *e = (struct equeue_source_event *)p;
+    e->source->cb.signal(e->source->data,
+            (struct signalfd_siginfo *)e->record);
+}
+
+static void equeue_source_child_dispatch(void *p) {
+    struct equeue_source_event *e = (struct equeue_source_event *)p;
+    e->source->cb.child(e->source->data, (siginfo_t *)e->record);
+}
+
+static void equeue_source_inotify_dispatch(void *p) {
+    struct equeue_source_event *e = (struct equeue_source_event *)p;
+    e->source->cb.inotify(e->source->data,
+            (struct inotify_event *)e->record);
+}
+
+static void equeue_source_recv_dispatch(void *p) {
+    struct equeue_source_event *e = (struct equeue_source_event *)p;
+    e->source->cb.recv(e->source->data,
+            (struct equeue_datagram *)e->record);
+}
+
+static void equeue_source_post(equeue_source_t *s, void (*dispatch)(void *),
+        const void *record, size_t size) {
+    struct equeue_source_event *e = equeue_alloc(s->queue,
+            sizeof(struct equeue_source_event) + size);
+    if (!e) {
+        s->dropped += 1;
+        return;
+    }
+
+    e->source = s;
+    memcpy(e->record, record, size);
+    equeue_post(s->queue, dispatch, e);
+}
+
+static int equeue_source_attach(equeue_source_t *s, equeue_t *q, int fd,
+        void (*ready)(struct equeue_sema_source *), void *data) {
+    if (fd < 0) {
+        return -errno;
+    }
+
+    s->source.fd = fd;
+    s->source.ready = ready;
+    s->queue = q;
+    s->data = data;
+    s->dropped = 0;
+
+    int err = equeue_sema_attach(&q->eventsema, &s->source);
+    if (err) {
+        close(fd);
+    }
+
+    return err;
+}
+
+static void equeue_source_signal_ready(struct equeue_sema_source *p) {
+    equeue_source_t *s = (equeue_source_t *)p;
+    struct signalfd_siginfo info;
+    while (read(s->source.fd, &info, sizeof(info)) == sizeof(info)) {
+        equeue_source_post(s, equeue_source_signal_dispatch,
+                &info, sizeof(info));
+    }
+}
+
+int equeue_source_signal(equeue_source_t *s, equeue_t *q,
+        const sigset_t *mask,
+        void (*cb)(void *data, struct signalfd_siginfo *info), void *data) {
+    int fd = signalfd(-1, mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    s->cb.signal = cb;
+    return equeue_source_attach(s, q, fd, equeue_source_signal_ready, data);
+}
+
+static void equeue_source_child_ready(struct equeue_sema_source *p) {
+    equeue_source_t *s = (equeue_source_t *)p;
+    siginfo_t info;
+    memset(&info, 0, sizeof(info));
+    if (waitid((idtype_t)P_PIDFD, s->source.fd, &info,
+            WEXITED | WNOHANG) || !info.si_pid) {
+        return;
+    }
+
+    // a pidfd stays readable once the child has exited
+    equeue_sema_detach(&s->queue->eventsema, &s->source);
+    equeue_source_post(s, equeue_source_child_dispatch, &info, sizeof(info));
+}
+
+int equeue_source_child(equeue_source_t *s, equeue_t *q, pid_t pid,
+        void (*cb)(void *data, siginfo_t *info), void *data) {
+    int fd = syscall(SYS_pidfd_open, pid, 0);
+    s->cb.child = cb;
+    return equeue_source_attach(s, q, fd, equeue_source_child_ready, data);
+}
+
+static void equeue_source_inotify_ready(struct equeue_sema_source *p) {
+    equeue_source_t *s = (equeue_source_t *)p;
+    uint64_t buffer[4096 / sizeof(uint64_t)];
+    ssize_t size;
+    while ((size = read(s->source.fd, buffer, sizeof(buffer))) > 0) {
+        for (unsigned char *i = (unsigned char *)buffer;
+                i < (unsigned char *)buffer + size;) {
+            struct inotify_event *event = (struct inotify_event *)i;
+            size_t len = sizeof(struct inotify_event) + event->len;
+            equeue_source_post(s, equeue_source_inotify_dispatch,
+                    event, len);
+            i += len;
+        }
+    }
+}
+
+int equeue_source_inotify(equeue_source_t *s, equeue_t *q,
+        const char *path, uint32_t mask,
+        void (*cb)(void *data, struct inotify_event *event), void *data) {
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd >= 0 && inotify_add_watch(fd, path, mask) < 0) {
+        int err = -errno;
+        close(fd);
+        return err;
+    }
+
+    s->cb.inotify = cb;
+    return equeue_source_attach(s, q, fd, equeue_source_inotify_ready, data);
+}
+
+static void equeue_source_recv_ready(struct equeue_sema_source *p) {
+    equeue_source_t *s = (equeue_source_t *)p;
+
+    // allocate a batch of events and receive straight into them, anything
+    // left in the socket is received by the next wait after dispatching
+    struct equeue_source_event *es[EQUEUE_SOURCE_BATCH];
+    struct mmsghdr msgs[EQUEUE_SOURCE_BATCH];
+    struct iovec iovs[EQUEUE_SOURCE_BATCH];
+    unsigned count = 0;
+    for (; count < EQUEUE_SOURCE_BATCH; count++) {
+        struct equeue_source_event *e = equeue_alloc(s->queue,
+                sizeof(struct equeue_source_event) +
+                sizeof(struct equeue_datagram) + s->size);
+        if (!e) {
+            break;
+        }
+
+        e->source = s;
+        struct equeue_datagram *d = (struct equeue_datagram *)e->record;
+        iovs[count].iov_base = d->data;
+        iovs[count].iov_len = s->size;
+        memset(&msgs[count], 0, sizeof(struct mmsghdr));
+        msgs[count].msg_hdr.msg_name = &d->addr;
+        msgs[count].msg_hdr.msg_namelen = sizeof(d->addr);
+        msgs[count].msg_hdr.msg_iov = &iovs[count];
+        msgs[count].msg_hdr.msg_iovlen = 1;
+        es[count] = e;
+    }
+
+    if (!count) {
+        // drop a datagram rather than waking again for it
+        if (recv(s->source.fd, 0, 0, MSG_DONTWAIT) >= 0) {
+            s->dropped += 1;
+        }
+        return;
+    }
+
+    int received = recvmmsg(s->source.fd, msgs, count, MSG_DONTWAIT, 0);
+    if (received < 0) {
+        received = 0;
+    }
+
+    for (int i = 0; i < received; i++) {
+        struct equeue_datagram *d = (struct equeue_datagram *)es[i]->record;
+        d->size = msgs[i].msg_len;
+        d->flags = msgs[i].msg_hdr.msg_flags;
+        d->addrlen = msgs[i].msg_hdr.msg_namelen;
+    }
+
+    equeue_post_batch(s->queue, equeue_source_recv_dispatch,
+            (void **)es, received, 0);
+
+    for (unsigned i = received; i < count; i++) {
+        equeue_dealloc(s->queue, es[i]);
+    }
+}
+
+int equeue_source_recv(equeue_source_t *s, equeue_t *q, int sock,
+        size_t size,
+        void (*cb)(void *data, struct equeue_datagram *datagram), void *data) {
+    s->size = size;
+    int fd = fcntl(sock, F_DUPFD_CLOEXEC, 0);
+    s->cb.recv = cb;
+    return equeue_source_attach(s, q, fd, equeue_source_recv_ready, data);
+}
+
+void equeue_source_destroy(equeue_source_t *s) {
+    equeue_sema_detach(&s->queue->eventsema, &s->source);
+    close(s->source.fd);
+}
+
+#endif
@@ -17,6 +17,10 @@ unsigned equeue_tick(void) {
     return xTaskGetTickCountFromISR() * portTICK_PERIOD_MS;
 }
 
+unsigned equeue_utick(void) {
+    return xTaskGetTickCountFromISR() * portTICK_PERIOD_MS * 1000;
+}
+
 
 // Mutex operations
 int equeue_mutex_create(equeue_mutex_t *m) { return 0; }
@@ -49,6 +49,10 @@ unsigned equeue_tick() {
     return (equeue_minutes << 16) + equeue_ms;
 }
 
+unsigned equeue_utick() {
+    return us_ticker_read();
+}
+
 
 // Mutex operations
 int equeue_mutex_create(equeue_mutex_t *m) { return 0; }
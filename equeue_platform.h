@@ -59,6 +59,15 @@ extern "C" {
 // Must intentionally overflow to 0 after 2^32-1
 unsigned equeue_tick(void);
 
+// Platform microsecond counter
+//
+// Return a tick that represents the number of microseconds that have passed
+// since an arbitrary point in time. This is only used to measure callback
+// runtimes when profiling, so a coarser granularity is acceptable.
+//
+// Must intentionally overflow to 0 after 2^32-1
+unsigned equeue_utick(void);
+
 
 // Platform mutex type
 //
@@ -107,6 +116,10 @@ typedef struct equeue_sema {
     pthread_mutex_t mutex;
     pthread_cond_t cond;
     bool signal;
+#ifdef __linux__
+    int epoll;
+    int event;
+#endif
 } equeue_sema_t;
 #elif defined(EQUEUE_PLATFORM_WINDOWS)
 typedef HANDLE equeue_sema_t;
@@ -139,6 +152,29 @@ void equeue_sema_destroy(equeue_sema_t *sema);
 void equeue_sema_signal(equeue_sema_t *sema);
 bool equeue_sema_wait(equeue_sema_t *sema, int ms);
 
+#if defined(EQUEUE_PLATFORM_POSIX) && defined(__linux__)
+// Platform semaphore file descriptor sources
+//
+// The equeue_sema_attach function adds a file descriptor to the wait of a
+// semaphore. Once a descriptor is attached, equeue_sema_wait sleeps in epoll
+// instead of on the condition variable, and calls the source's ready
+// function from the waiting thread whenever the descriptor is readable,
+// returning true afterwards as if signalled. The ready function must
+// consume the readiness or it will be called again by the next wait.
+//
+// The equeue_sema_detach function removes a descriptor from the wait. It
+// must be called from the waiting thread or while no thread is waiting.
+//
+// Only available on Linux, other platforms do not need to provide these.
+struct equeue_sema_source {
+    int fd;
+    void (*ready)(struct equeue_sema_source *source);
+};
+
+int equeue_sema_attach(equeue_sema_t *sema, struct equeue_sema_source *source);
+void equeue_sema_detach(equeue_sema_t *sema, struct equeue_sema_source *source);
+#endif
+
 
 #ifdef __cplusplus
 }
@@ -11,6 +11,12 @@
 #include <time.h>
 #include <sys/time.h>
 #include <errno.h>
+#ifdef __linux__
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
 
 
 // Tick operations
@@ -20,6 +26,12 @@ unsigned equeue_tick(void) {
     return (unsigned)(tv.tv_sec*1000 + tv.tv_usec/1000);
 }
 
+unsigned equeue_utick(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned)(ts.tv_sec*1000000 + ts.tv_nsec/1000);
+}
+
 
 // Mutex operations
 int equeue_mutex_create(equeue_mutex_t *m) {
@@ -52,23 +64,122 @@ int equeue_sema_create(equeue_sema_t *s) {
     }
 
     s->signal = false;
+#ifdef __linux__
+    s->epoll = -1;
+    s->event = -1;
+#endif
     return 0;
 }
 
 void equeue_sema_destroy(equeue_sema_t *s) {
+#ifdef __linux__
+    if (s->epoll >= 0) {
+        close(s->event);
+        close(s->epoll);
+    }
+#endif
     pthread_cond_destroy(&s->cond);
     pthread_mutex_destroy(&s->mutex);
 }
 
 void equeue_sema_signal(equeue_sema_t *s) {
     pthread_mutex_lock(&s->mutex);
+#ifdef __linux__
+    if (s->epoll >= 0 && !s->signal) {
+        // a set signal is seen by the waiter before it sleeps
+        uint64_t count = 1;
+        write(s->event, &count, sizeof(count));
+    }
+#endif
     s->signal = true;
     pthread_cond_signal(&s->cond);
     pthread_mutex_unlock(&s->mutex);
 }
 
+#ifdef __linux__
+static bool equeue_sema_poll(equeue_sema_t *s, int ms) {
+    struct epoll_event events[8];
+    int count = epoll_wait(s->epoll, events, 8, ms);
+    if (count > 0) {
+        // this wait returns true, so posts from the sources need not write
+        // to the eventfd
+        pthread_mutex_lock(&s->mutex);
+        s->signal = true;
+        pthread_mutex_unlock(&s->mutex);
+    }
+
+    for (int i = 0; i < count; i++) {
+        struct equeue_sema_source *source =
+                (struct equeue_sema_source *)events[i].data.ptr;
+        if (source) {
+            source->ready(source);
+        } else {
+            uint64_t signals;
+            read(s->event, &signals, sizeof(signals));
+        }
+    }
+
+    pthread_mutex_lock(&s->mutex);
+    bool signal = s->signal || count > 0;
+    s->signal = false;
+    pthread_mutex_unlock(&s->mutex);
+
+    return signal;
+}
+
+int equeue_sema_attach(equeue_sema_t *s, struct equeue_sema_source *source) {
+    pthread_mutex_lock(&s->mutex);
+    if (s->epoll < 0) {
+        int epoll = epoll_create1(EPOLL_CLOEXEC);
+        int event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        struct epoll_event ev = {.events = EPOLLIN, .data.ptr = 0};
+        if (epoll < 0 || event < 0 ||
+                epoll_ctl(epoll, EPOLL_CTL_ADD, event, &ev)) {
+            int err = -errno;
+            if (event >= 0) {
+                close(event);
+            }
+            if (epoll >= 0) {
+                close(epoll);
+            }
+            pthread_mutex_unlock(&s->mutex);
+            return err;
+        }
+
+        s->epoll = epoll;
+        s->event = event;
+    }
+
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = source};
+    int err = epoll_ctl(s->epoll, EPOLL_CTL_ADD, source->fd, &ev) ? -errno : 0;
+
+    // wake any waiter still sleeping on the condition variable
+    s->signal = true;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->mutex);
+    return err;
+}
+
+void equeue_sema_detach(equeue_sema_t *s, struct equeue_sema_source *source) {
+    pthread_mutex_lock(&s->mutex);
+    if (s->epoll >= 0) {
+        epoll_ctl(s->epoll, EPOLL_CTL_DEL, source->fd, 0);
+    }
+    pthread_mutex_unlock(&s->mutex);
+}
+#endif
+
 bool equeue_sema_wait(equeue_sema_t *s, int ms) {
     pthread_mutex_lock(&s->mutex);
+#ifdef __linux__
+    if (s->epoll >= 0) {
+        // sources are polled even when already signalled, otherwise a
+        // steady stream of posts would starve them
+        int timeout = s->signal ? 0 : ms;
+        pthread_mutex_unlock(&s->mutex);
+        return equeue_sema_poll(s, timeout);
+    }
+#endif
     if (!s->signal) {
         if (ms < 0) {
             pthread_cond_wait(&s->cond, &s->mutex);
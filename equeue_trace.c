@@ -0,0 +1,230 @@
+/*
+ * Trace recorders and diagnostics for the equeue library
+ *
+ * Copyright (c) 2016 Christopher Haster
+ * Distributed under the MIT license
+ */
+#define _GNU_SOURCE
+#include "equeue.h"
+
+#if (defined(EQUEUE_TRACE) || defined(EQUEUE_PROFILE) || \
+     defined(EQUEUE_WATCHDOG)) && defined(EQUEUE_PLATFORM_POSIX)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/syscall.h>
+
+
+// Shared recorder utilities
+#ifdef EQUEUE_TRACE
+static unsigned long long equeue_trace_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+#endif
+
+#if defined(EQUEUE_TRACE) || defined(EQUEUE_PROFILE)
+static void equeue_trace_symbol(void (*cb)(void *), char *buf, size_t size) {
+    // ISO C has no conversion between function and object pointers
+    void *p;
+    memcpy(&p, &cb, sizeof(p));
+
+    Dl_info info;
+    if (dladdr(p, &info) && info.dli_sname) {
+        snprintf(buf, size, "%s", info.dli_sname);
+    } else {
+        snprintf(buf, size, "%p", p);
+    }
+}
+#endif
+
+
+#ifdef EQUEUE_TRACE
+// Chrome trace event recorder
+static void equeue_trace_chrome_hook(void *p,
+        const struct equeue_trace_record *r) {
+    FILE *f = (FILE *)p;
+    unsigned long long ts = equeue_trace_us();
+    long pid = (long)getpid();
+    long tid = (long)syscall(SYS_gettid);
+
+    char name[64] = "?";
+    if (r->cb) {
+        equeue_trace_symbol(r->cb, name, sizeof(name));
+    }
+
+    flockfile(f);
+    switch (r->type) {
+        case EQUEUE_TRACE_POST:
+            fprintf(f, "{\"name\":\"post\",\"cat\":\"equeue\",\"ph\":\"i\","
+                    "\"s\":\"t\",\"ts\":%llu,\"pid\":%ld,\"tid\":%ld,"
+                    "\"args\":{\"queue\":\"%p\",\"id\":%d,\"cb\":\"%s\","
+                    "\"size\":%u,\"delay\":%d,\"period\":%d}},\n",
+                    ts, pid, tid, (void *)r->queue, r->id, name,
+                    r->size, r->delay, r->period);
+            break;
+        case EQUEUE_TRACE_CANCEL:
+            fprintf(f, "{\"name\":\"cancel\",\"cat\":\"equeue\",\"ph\":\"i\","
+                    "\"s\":\"t\",\"ts\":%llu,\"pid\":%ld,\"tid\":%ld,"
+                    "\"args\":{\"queue\":\"%p\",\"id\":%d}},\n",
+                    ts, pid, tid, (void *)r->queue, r->id);
+            break;
+        case EQUEUE_TRACE_BATCH:
+            fprintf(f, "{\"name\":\"dequeue\",\"cat\":\"equeue\",\"ph\":\"i\","
+                    "\"s\":\"t\",\"ts\":%llu,\"pid\":%ld,\"tid\":%ld,"
+                    "\"args\":{\"queue\":\"%p\",\"count\":%u}},\n",
+                    ts, pid, tid, (void *)r->queue, r->count);
+            break;
+        case EQUEUE_TRACE_CALL:
+            fprintf(f, "{\"name\":\"%s\",\"cat\":\"callback\",\"ph\":\"B\","
+                    "\"ts\":%llu,\"pid\":%ld,\"tid\":%ld,"
+                    "\"args\":{\"queue\":\"%p\",\"id\":%d}},\n",
+                    name, ts, pid, tid, (void *)r->queue, r->id);
+            break;
+        case EQUEUE_TRACE_RETURN:
+            fprintf(f, "{\"name\":\"%s\",\"cat\":\"callback\",\"ph\":\"E\","
+                    "\"ts\":%llu,\"pid\":%ld,\"tid\":%ld},\n",
+                    name, ts, pid, tid);
+            break;
+        case EQUEUE_TRACE_SLEEP:
+            fprintf(f, "{\"name\":\"sleep\",\"cat\":\"equeue\",\"ph\":\"B\","
+                    "\"ts\":%llu,\"pid\":%ld,\"tid\":%ld,"
+                    "\"args\":{\"queue\":\"%p\",\"ms\":%d}},\n",
+                    ts, pid, tid, (void *)r->queue, r->delay);
+            break;
+        case EQUEUE_TRACE_WAKE:
+            fprintf(f, "{\"name\":\"sleep\",\"cat\":\"equeue\",\"ph\":\"E\","
+                    "\"ts\":%llu,\"pid\":%ld,\"tid\":%ld},\n",
+                    ts, pid, tid);
+            break;
+        case EQUEUE_TRACE_NOMEM:
+            fprintf(f, "{\"name\":\"alloc failure\",\"cat\":\"equeue\","
+                    "\"ph\":\"i\",\"s\":\"p\",\"ts\":%llu,\"pid\":%ld,"
+                    "\"tid\":%ld,\"args\":{\"queue\":\"%p\",\"size\":%u}},\n",
+                    ts, pid, tid, (void *)r->queue, r->size);
+            break;
+    }
+    funlockfile(f);
+}
+
+int equeue_trace_chrome(equeue_t *q, FILE *f) {
+    if (fputs("[\n", f) < 0) {
+        return -1;
+    }
+
+    equeue_trace(q, equeue_trace_chrome_hook, f);
+    return 0;
+}
+
+
+// Binary operation log recorder
+static void equeue_trace_log_hook(void *p,
+        const struct equeue_trace_record *r) {
+    if (r->type != EQUEUE_TRACE_POST && r->type != EQUEUE_TRACE_CANCEL) {
+        return;
+    }
+
+    struct equeue_log_record l;
+    l.time = (uint32_t)equeue_trace_us();
+    l.type = (r->type == EQUEUE_TRACE_POST)
+            ? EQUEUE_LOG_POST : EQUEUE_LOG_CANCEL;
+    l.id = r->id;
+    l.size = r->size ? r->size - sizeof(struct equeue_event) : 0;
+    l.delay = r->delay;
+    l.period = r->period;
+
+    // a single write keeps records from concurrent posters whole
+    fwrite(&l, sizeof(l), 1, (FILE *)p);
+}
+
+int equeue_trace_log(equeue_t *q, FILE *f) {
+    if (fwrite(EQUEUE_LOG_MAGIC, sizeof(EQUEUE_LOG_MAGIC), 1, f) != 1) {
+        return -1;
+    }
+
+    equeue_trace(q, equeue_trace_log_hook, f);
+    return 0;
+}
+#endif
+
+
+#ifdef EQUEUE_PROFILE
+// Per-callback profile report
+static int equeue_profile_cmp(const void *a, const void *b) {
+    const struct equeue_profile *pa = *(const struct equeue_profile **)a;
+    const struct equeue_profile *pb = *(const struct equeue_profile **)b;
+    return (pa->runtime < pb->runtime) - (pa->runtime > pb->runtime);
+}
+
+void equeue_profile_dump(equeue_t *q, FILE *f) {
+    // sort a snapshot of the occupied entries by total runtime
+    const struct equeue_profile *entries[EQUEUE_PROFILE_SIZE];
+    unsigned count = 0;
+    for (unsigned i = 0; i < EQUEUE_PROFILE_SIZE; i++) {
+        if (q->profiler.entries[i].cb) {
+            entries[count++] = &q->profiler.entries[i];
+        }
+    }
+
+    qsort(entries, count, sizeof(entries[0]), equeue_profile_cmp);
+
+    fprintf(f, "%-32s %10s %12s %10s %10s %10s\n", "callback",
+            "calls", "total (us)", "avg (us)", "max (us)", "late (ms)");
+    for (unsigned i = 0; i < count; i++) {
+        const struct equeue_profile *p = entries[i];
+        char name[64];
+        equeue_trace_symbol(p->cb, name, sizeof(name));
+        fprintf(f, "%-32s %10u %12llu %10llu %10u %10.2f\n", name,
+                p->calls, (unsigned long long)p->runtime,
+                (unsigned long long)(p->runtime / p->calls),
+                p->max_runtime, (double)p->lateness / p->calls);
+    }
+
+    if (q->profiler.untracked) {
+        fprintf(f, "%-32s %10u\n", "(untracked)", q->profiler.untracked);
+    }
+}
+#endif
+
+
+#ifdef EQUEUE_WATCHDOG
+// Watchdog thread
+static void *equeue_watchdog_thread(void *p) {
+    equeue_watchdog_t *w = (equeue_watchdog_t *)p;
+    int interval = w->threshold > 1 ? w->threshold/2 : 1;
+
+    while (!equeue_sema_wait(&w->stop, interval)) {
+        equeue_watchdog_check(w);
+    }
+
+    return 0;
+}
+
+int equeue_watchdog_start(equeue_watchdog_t *w) {
+    int err = equeue_sema_create(&w->stop);
+    if (err < 0) {
+        return err;
+    }
+
+    err = pthread_create(&w->thread, 0, equeue_watchdog_thread, w);
+    if (err) {
+        equeue_sema_destroy(&w->stop);
+        return -err;
+    }
+
+    return 0;
+}
+
+void equeue_watchdog_stop(equeue_watchdog_t *w) {
+    equeue_sema_signal(&w->stop);
+    pthread_join(w->thread, 0);
+    equeue_sema_destroy(&w->stop);
+}
+#endif
+
+#endif
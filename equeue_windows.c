@@ -16,6 +16,14 @@ unsigned equeue_tick(void) {
     return GetTickCount();
 }
 
+unsigned equeue_utick(void) {
+    LARGE_INTEGER count, freq;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+    return (unsigned)((count.QuadPart / freq.QuadPart) * 1000000
+            + (count.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart);
+}
+
 
 // Mutex operations
 int equeue_mutex_create(equeue_mutex_t *m) {
@@ -0,0 +1,416 @@
+/*
+ * Synthetic workload generator for the events library
+ *
+ * Copyright (c) 2016 Christopher Haster
+ * Distributed under the MIT license
+ */
+#include "equeue.h"
+#include <unistd.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+
+
+// Workload configuration
+struct bench_range {
+    unsigned min;
+    unsigned max;
+};
+
+static struct bench_config {
+    unsigned producers;
+    unsigned duration;
+    double rate;
+    unsigned window;
+    struct bench_range size;
+    struct bench_range delay;
+    double cancels;
+    double periodic;
+    unsigned cost;
+    unsigned buffer;
+    unsigned seed;
+    const char *log;
+} config = {
+    .producers = 1,
+    .duration = 1000,
+    .rate = 0,
+    .window = 1,
+    .size = {0, 0},
+    .delay = {0, 0},
+    .cancels = 0,
+    .periodic = 0,
+    .cost = 0,
+    .buffer = 64*1024,
+    .seed = 1,
+};
+
+static void bench_usage(const char *name) {
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -t producers   producer threads (%u)\n"
+        "  -d ms          duration of the run (%u)\n"
+        "  -r rate        open loop, events/s per producer with poisson "
+                         "arrivals\n"
+        "  -w window      closed loop, events in flight per producer (%u)\n"
+        "  -s min[:max]   uniform payload size in bytes (%u)\n"
+        "  -D min[:max]   uniform event delay in ms (%u)\n"
+        "  -c ratio       fraction of events cancelled by their producer\n"
+        "  -p ratio       fraction of events that are periodic, the period "
+                         "is the delay\n"
+        "  -C us          busy cost of each callback (%u)\n"
+        "  -b bytes       event queue buffer size (%u)\n"
+        "  -S seed        random seed (%u)\n"
+#ifdef EQUEUE_TRACE
+        "  -l file        record an operation log for tests/replay\n"
+#endif
+        ,
+        name, config.producers, config.duration, config.window,
+        config.size.min, config.delay.min, config.cost, config.buffer,
+        config.seed);
+    exit(1);
+}
+
+static struct bench_range bench_parse_range(const char *arg) {
+    struct bench_range range;
+    char *end;
+    range.min = strtoul(arg, &end, 0);
+    range.max = (*end == ':') ? strtoul(end+1, 0, 0) : range.min;
+    if (range.max < range.min) {
+        range.max = range.min;
+    }
+    return range;
+}
+
+
+// Random distributions, xorshift is plenty and keeps producers independent
+static uint32_t bench_random(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static double bench_uniform(uint32_t *state) {
+    return (bench_random(state) >> 8) / (double)(1 << 24);
+}
+
+static unsigned bench_pick(uint32_t *state, struct bench_range range) {
+    return range.min + bench_random(state) % (range.max - range.min + 1);
+}
+
+
+// Shared state, updated only by the dispatch thread unless noted
+#define BENCH_SAMPLES (1 << 20)
+
+static equeue_t q;
+static unsigned bench_latency[BENCH_SAMPLES];
+static unsigned long long bench_executed;
+static unsigned bench_samples;
+
+struct bench_producer {
+    pthread_t thread;
+    uint32_t seed;
+
+    // completions reported by the event destructors
+    equeue_mutex_t lock;
+    equeue_sema_t window;
+    unsigned done;
+    unsigned long long cancelled;
+
+    // updated by the producer thread
+    unsigned long long posted;
+    unsigned long long periodic;
+    unsigned long long failures;
+    int *ids;
+    unsigned nids;
+};
+
+struct bench_event {
+    struct bench_producer *producer;
+    unsigned target;
+    unsigned period;
+    bool ran;
+};
+
+static void bench_spin(unsigned us) {
+    unsigned start = equeue_utick();
+    while (equeue_utick() - start < us);
+}
+
+static void bench_func(void *p) {
+    struct bench_event *e = (struct bench_event *)p;
+    unsigned now = equeue_utick();
+    int late = (int)(now - e->target);
+
+    if (bench_samples < BENCH_SAMPLES) {
+        bench_latency[bench_samples++] = late > 0 ? late : 0;
+    }
+    bench_executed += 1;
+    e->ran = true;
+
+    // the queue clamps a late periodic event to the current tick instead
+    // of catching up on missed releases, so follow it
+    e->target += e->period;
+    if ((int)(e->target - now) < 0) {
+        e->target = now;
+    }
+
+    bench_spin(config.cost);
+}
+
+static void bench_dtor(void *p) {
+    // runs on completion or cancellation, opening the closed loop window,
+    // events that never ran were removed by a cancel
+    struct bench_event *e = (struct bench_event *)p;
+    if (!e->period) {
+        equeue_mutex_lock(&e->producer->lock);
+        e->producer->done += 1;
+        if (!e->ran) {
+            e->producer->cancelled += 1;
+        }
+        equeue_mutex_unlock(&e->producer->lock);
+        equeue_sema_signal(&e->producer->window);
+    }
+}
+
+static void bench_sleep(unsigned us) {
+    struct timespec ts = {us / 1000000, (us % 1000000) * 1000};
+    nanosleep(&ts, 0);
+}
+
+static void *bench_produce(void *p) {
+    struct bench_producer *producer = (struct bench_producer *)p;
+    unsigned start = equeue_utick();
+    unsigned next = start;
+    unsigned inflight = 0;
+    int last = 0;
+
+    while (equeue_utick() - start < config.duration*1000) {
+        if (config.rate) {
+            // open loop, poisson arrivals
+            double gap = -log(1.0 - bench_uniform(&producer->seed));
+            next += (unsigned)(gap * 1000000 / config.rate);
+            int wait = (int)(next - equeue_utick());
+            if (wait > 0) {
+                bench_sleep(wait);
+            }
+        } else {
+            // closed loop, wait for one of our events to finish
+            equeue_mutex_lock(&producer->lock);
+            inflight -= producer->done;
+            producer->done = 0;
+            equeue_mutex_unlock(&producer->lock);
+
+            if (inflight >= config.window) {
+                equeue_sema_wait(&producer->window, 10);
+                continue;
+            }
+        }
+
+        if (last && bench_uniform(&producer->seed) < config.cancels) {
+            equeue_cancel(&q, last);
+        }
+
+        unsigned size = bench_pick(&producer->seed, config.size);
+        if (size < sizeof(struct bench_event)) {
+            size = sizeof(struct bench_event);
+        }
+
+        struct bench_event *e = equeue_alloc(&q, size);
+        if (!e) {
+            // open loop drops the arrival, closed loop waits for memory
+            producer->failures += 1;
+            last = 0;
+            if (!config.rate) {
+                equeue_sema_wait(&producer->window, 1);
+            }
+            continue;
+        }
+
+        unsigned delay = bench_pick(&producer->seed, config.delay);
+        int periodic = bench_uniform(&producer->seed) < config.periodic &&
+                producer->nids < 1024;
+
+        e->producer = producer;
+        e->ran = false;
+        e->target = equeue_utick() + delay*1000;
+        e->period = periodic ? (delay ? delay : 1)*1000 : 0;
+        equeue_event_delay(e, delay);
+        if (periodic) {
+            equeue_event_period(e, delay ? delay : 1);
+        }
+        equeue_event_dtor(e, bench_dtor);
+
+        int id = equeue_post(&q, bench_func, e);
+        producer->posted += 1;
+        if (periodic) {
+            producer->ids[producer->nids++] = id;
+            producer->periodic += 1;
+            last = 0;
+        } else {
+            inflight += 1;
+            last = id;
+        }
+    }
+
+    // periodic events would run forever
+    for (unsigned i = 0; i < producer->nids; i++) {
+        equeue_cancel(&q, producer->ids[i]);
+    }
+
+    return 0;
+}
+
+static void *bench_dispatch(void *p) {
+    equeue_dispatch(&q, -1);
+    return 0;
+}
+
+static void bench_break(void *p) {
+    equeue_break(&q);
+}
+
+static int bench_cmp(const void *a, const void *b) {
+    unsigned ua = *(const unsigned *)a;
+    unsigned ub = *(const unsigned *)b;
+    return (ua > ub) - (ua < ub);
+}
+
+static unsigned bench_percentile(double p) {
+    if (!bench_samples) {
+        return 0;
+    }
+
+    unsigned i = (unsigned)(p * (bench_samples - 1) + 0.5);
+    return bench_latency[i];
+}
+
+
+// Entry point
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "t:d:r:w:s:D:c:p:C:b:S:l:h")) != -1) {
+        switch (opt) {
+            case 't': config.producers = strtoul(optarg, 0, 0); break;
+            case 'd': config.duration = strtoul(optarg, 0, 0); break;
+            case 'r': config.rate = strtod(optarg, 0); break;
+            case 'w': config.window = strtoul(optarg, 0, 0); break;
+            case 's': config.size = bench_parse_range(optarg); break;
+            case 'D': config.delay = bench_parse_range(optarg); break;
+            case 'c': config.cancels = strtod(optarg, 0); break;
+            case 'p': config.periodic = strtod(optarg, 0); break;
+            case 'C': config.cost = strtoul(optarg, 0, 0); break;
+            case 'b': config.buffer = strtoul(optarg, 0, 0); break;
+            case 'S': config.seed = strtoul(optarg, 0, 0); break;
+#ifdef EQUEUE_TRACE
+            case 'l': config.log = optarg; break;
+#endif
+            default: bench_usage(argv[0]);
+        }
+    }
+
+    if (!config.producers || !config.window) {
+        bench_usage(argv[0]);
+    }
+
+    printf("workload: %u producers, %s %g, size %u-%u, delay %u-%u ms, "
+            "cancel %g, periodic %g, cost %u us, buffer %u\n",
+            config.producers, config.rate ? "rate" : "window",
+            config.rate ? config.rate : (double)config.window,
+            config.size.min, config.size.max,
+            config.delay.min, config.delay.max,
+            config.cancels, config.periodic, config.cost, config.buffer);
+
+    int err = equeue_create(&q, config.buffer);
+    if (err) {
+        fprintf(stderr, "could not create a %u byte event queue\n",
+                config.buffer);
+        return 1;
+    }
+
+#ifdef EQUEUE_TRACE
+    FILE *log = 0;
+    if (config.log) {
+        log = fopen(config.log, "wb");
+        if (!log || equeue_trace_log(&q, log)) {
+            fprintf(stderr, "could not record to %s\n", config.log);
+            return 1;
+        }
+    }
+#endif
+
+    struct bench_producer *producers = calloc(config.producers,
+            sizeof(struct bench_producer));
+    for (unsigned i = 0; i < config.producers; i++) {
+        producers[i].seed = config.seed + 0x9e3779b9*i;
+        producers[i].ids = malloc(1024*sizeof(int));
+        equeue_mutex_create(&producers[i].lock);
+        equeue_sema_create(&producers[i].window);
+    }
+
+    pthread_t dispatcher;
+    pthread_create(&dispatcher, 0, bench_dispatch, 0);
+
+    unsigned start = equeue_utick();
+    for (unsigned i = 0; i < config.producers; i++) {
+        pthread_create(&producers[i].thread, 0, bench_produce, &producers[i]);
+    }
+
+    for (unsigned i = 0; i < config.producers; i++) {
+        pthread_join(producers[i].thread, 0);
+    }
+
+    // drain the delayed events before stopping
+    while (!equeue_call_in(&q, config.delay.max + 1, bench_break, 0)) {
+        bench_sleep(1000);
+    }
+    pthread_join(dispatcher, 0);
+    unsigned elapsed = equeue_utick() - start;
+
+#ifdef EQUEUE_TRACE
+    if (log) {
+        equeue_trace(&q, 0, 0);
+        fclose(log);
+    }
+#endif
+
+    struct bench_producer total = {0};
+    for (unsigned i = 0; i < config.producers; i++) {
+        total.posted += producers[i].posted;
+        total.cancelled += producers[i].cancelled;
+        total.periodic += producers[i].periodic;
+        total.failures += producers[i].failures;
+    }
+
+    qsort(bench_latency, bench_samples, sizeof(unsigned), bench_cmp);
+
+    printf("events: %llu posted, %llu periodic, %llu cancels, "
+            "%llu executed, %llu alloc failures\n",
+            total.posted, total.periodic, total.cancelled,
+            bench_executed, total.failures);
+    printf("throughput: %.0f posts/s, %.0f callbacks/s\n",
+            total.posted / (elapsed / 1e6),
+            bench_executed / (elapsed / 1e6));
+    printf("latency (us): p50 %u, p90 %u, p99 %u, p99.9 %u, max %u\n",
+            bench_percentile(0.5), bench_percentile(0.9),
+            bench_percentile(0.99), bench_percentile(0.999),
+            bench_percentile(1.0));
+    // freed chunks are reused before the slab, so the slab is the high-water
+    printf("memory: %u of %u bytes high-water\n",
+            (unsigned)(config.buffer - q.slab.size), config.buffer);
+
+    for (unsigned i = 0; i < config.producers; i++) {
+        equeue_sema_destroy(&producers[i].window);
+        equeue_mutex_destroy(&producers[i].lock);
+        free(producers[i].ids);
+    }
+    free(producers);
+    equeue_destroy(&q);
+    return 0;
+}
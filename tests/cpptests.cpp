@@ -0,0 +1,453 @@
+/*
+ * Testing framework for the C++ interface of the events library
+ *
+ * Copyright (c) 2016 Christopher Haster
+ * Distributed under the MIT license
+ */
+#include "equeue.hpp"
+#include <unistd.h>
+#include <stdio.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <vector>
+#include <memory>
+
+
+// Testing setup
+static jmp_buf test_buf;
+static int test_line;
+static int test_failure;
+
+#define test_assert(test) ({                                                \
+    if (!(test)) {                                                          \
+        test_line = __LINE__;                                               \
+        longjmp(test_buf, 1);                                               \
+    }                                                                       \
+})
+
+#define test_run(func, ...) ({                                              \
+    printf("%s: ...", #func);                                               \
+    fflush(stdout);                                                         \
+                                                                            \
+    if (!setjmp(test_buf)) {                                                \
+        func(__VA_ARGS__);                                                  \
+        printf("\r%s: \e[32mpassed\e[0m\n", #func);                         \
+    } else {                                                                \
+        printf("\r%s: \e[31mfailed\e[0m at line %d\n", #func, test_line);   \
+        test_failure = true;                                                \
+    }                                                                       \
+})
+
+
+// Test functions
+void simple_func(void *p) {
+    (*(int *)p)++;
+}
+
+struct counted {
+    int *touched;
+    int *destroyed;
+    uint8_t buffer[24];
+
+    counted(int *touched, int *destroyed)
+        : touched(touched), destroyed(destroyed) {
+    }
+
+    ~counted() {
+        (*destroyed)++;
+    }
+};
+
+void counted_func(void *p) {
+    (*static_cast<counted *>(p)->touched)++;
+}
+
+struct throwing {
+    throwing() {
+    }
+
+    throwing(const throwing &) {
+        throw 1;
+    }
+
+    void operator()() {
+    }
+};
+
+
+// Static queue tests
+void static_queue_sizing_test(void) {
+    typedef events::static_queue<4, counted, uint64_t> queue;
+    static_assert(queue::payload_size == sizeof(counted),
+            "payload sized by the largest event type");
+#ifdef EQUEUE_COMPACT
+    static_assert(queue::buffer_size
+            == 4*(queue::event_size + sizeof(uintptr_t)),
+            "buffer sized for the requested events and their handles");
+#else
+    static_assert(queue::buffer_size == 4*queue::event_size,
+            "buffer sized for the requested events");
+#endif
+    static_assert(queue::event_size
+            == sizeof(struct equeue_event) + sizeof(counted),
+            "events sized like the equeue allocator");
+
+    typedef events::static_queue<4> call_queue;
+    static_assert(call_queue::event_size == EQUEUE_EVENT_SIZE,
+            "simple callbacks always fit");
+}
+
+void static_queue_call_test(void) {
+    events::static_queue<4> q;
+
+    int touched = 0;
+    int id = q.call(simple_func, &touched);
+    test_assert(id);
+
+    id = q.call_in(5, simple_func, &touched);
+    test_assert(id);
+
+    q.dispatch(10);
+    test_assert(touched == 2);
+}
+
+void static_queue_alloc_test(void) {
+    int touched = 0;
+    int destroyed = 0;
+
+    {
+        events::static_queue<4, counted> q;
+
+        for (int i = 0; i < 4; i++) {
+            counted *e = q.alloc<counted>(&touched, &destroyed);
+            test_assert(e);
+
+            int id = q.post(counted_func, e);
+            test_assert(id);
+        }
+
+        // every slot is in use, regardless of the event type
+        test_assert(!q.alloc<counted>(&touched, &destroyed));
+        test_assert(!q.call(simple_func, &touched));
+
+        q.dispatch(0);
+        test_assert(touched == 4);
+        test_assert(destroyed == 4);
+
+        // mixed sizes never fragment the buffer
+        for (int i = 0; i < 4; i++) {
+            int id = q.call(simple_func, &touched);
+            test_assert(id);
+        }
+        q.dispatch(0);
+
+        for (int i = 0; i < 4; i++) {
+            counted *e = q.alloc<counted>(&touched, &destroyed);
+            test_assert(e);
+            q.post(counted_func, e);
+        }
+    }
+
+    // pending events are destroyed with the queue
+    test_assert(touched == 8);
+    test_assert(destroyed == 8);
+
+    // slots are released when construction throws
+    events::static_queue<1, throwing> q;
+    throwing t;
+    for (int i = 0; i < 4; i++) {
+        bool caught = false;
+        try {
+            q.alloc<throwing>(t);
+        } catch (int) {
+            caught = true;
+        }
+        test_assert(caught);
+    }
+
+    test_assert(q.alloc<throwing>());
+}
+
+
+// Callable event tests
+static void *event_dtor_of(void *e) {
+    return (void *)(static_cast<struct equeue_event *>(e) - 1)->dtor;
+}
+
+void callable_event_test(void) {
+    equeue_t q;
+    int err = equeue_create(&q, 2048);
+    test_assert(!err);
+
+    int touched = 0;
+    auto trivial = [&touched]() { touched++; };
+    typedef events::callable_event<decltype(trivial)> trivial_event;
+
+    auto *e = trivial_event::create(&q, trivial);
+    test_assert(e);
+    test_assert(!event_dtor_of(e));
+    int id = trivial_event::post(&q, e);
+    test_assert(id);
+
+    // non-trivial callables register a destructor
+    std::shared_ptr<int> shared(new int(2));
+    auto owning = [&touched, shared]() { touched += *shared; };
+    typedef events::callable_event<decltype(owning)> owning_event;
+
+    auto *o = owning_event::create(&q, std::move(owning));
+    test_assert(o);
+    test_assert(event_dtor_of(o));
+    test_assert(shared.use_count() == 2);
+    id = owning_event::post(&q, o);
+    test_assert(id);
+
+    equeue_dispatch(&q, 0);
+    test_assert(touched == 3);
+    test_assert(shared.use_count() == 1);
+
+    // cancelled callables are destroyed without executing
+    id = events::call_in(&q, 10, [&touched, shared]() { touched++; });
+    test_assert(id);
+    test_assert(shared.use_count() == 2);
+    equeue_cancel(&q, id);
+    test_assert(shared.use_count() == 1);
+
+    id = events::call_every(&q, 5, [&touched]() { touched++; });
+    test_assert(id);
+    equeue_dispatch(&q, 12);
+    test_assert(touched == 5);
+
+    equeue_destroy(&q);
+}
+
+void callable_event_throw_test(void) {
+    equeue_t q;
+    int err = equeue_create(&q, 2048);
+    test_assert(!err);
+
+    // events are returned to the queue when construction throws
+    throwing t;
+    for (int i = 0; i < 100; i++) {
+        bool caught = false;
+        try {
+            events::call(&q, t);
+        } catch (int) {
+            caught = true;
+        }
+        test_assert(caught);
+    }
+
+    int touched = 0;
+    int id = events::call(&q, [&touched]() { touched++; });
+    test_assert(id);
+    equeue_dispatch(&q, 0);
+    test_assert(touched == 1);
+
+    equeue_destroy(&q);
+}
+
+void static_queue_callable_test(void) {
+    int touched = 0;
+    std::unique_ptr<int> owned(new int(2));
+    auto owning = [&touched, owned = std::move(owned)]() {
+        touched += *owned;
+    };
+
+    events::static_queue<2, decltype(owning)> q;
+    int id = q.call(std::move(owning));
+    test_assert(id);
+
+    id = q.call([&touched]() { touched++; });
+    test_assert(id);
+
+    q.dispatch(0);
+    test_assert(touched == 3);
+}
+
+
+// Memory resource tests
+void memory_resource_test(void) {
+    equeue_t q;
+    int err = equeue_create(&q, 4096);
+    test_assert(!err);
+
+    events::memory_resource mr(&q);
+    size_t slab = q.slab.size;
+
+    {
+        std::pmr::vector<int> v(&mr);
+        for (int i = 0; i < 100; i++) {
+            v.push_back(i);
+        }
+
+        test_assert(v[99] == 99);
+        test_assert(q.slab.size < slab - 100*sizeof(int));
+    }
+
+    // memory is reused once the container is gone
+    size_t used = q.slab.size;
+    {
+        std::pmr::vector<int> v(&mr);
+        for (int i = 0; i < 100; i++) {
+            v.push_back(i);
+        }
+    }
+    test_assert(q.slab.size == used);
+
+    void *p = mr.allocate(64, 64);
+    test_assert(((uintptr_t)p & 63) == 0);
+    mr.deallocate(p, 64, 64);
+
+    bool thrown = false;
+    try {
+        p = mr.allocate(8192);
+    } catch (std::bad_alloc &) {
+        thrown = true;
+    }
+    test_assert(thrown);
+
+    events::memory_resource other(&q);
+    test_assert(mr == other);
+
+    equeue_destroy(&q);
+}
+
+
+// Executor tests
+struct receiver {
+    int *values;
+    int *errors;
+
+    void set_value() {
+        (*values)++;
+    }
+
+    void set_error(std::exception_ptr) {
+        (*errors)++;
+    }
+
+    void set_stopped() {
+    }
+};
+
+void executor_test(void) {
+    equeue_t q;
+    int err = equeue_create(&q, 2048);
+    test_assert(!err);
+
+    events::executor ex(&q);
+    test_assert(ex == events::executor(&q));
+
+    int touched = 0;
+    int id = ex.execute([&touched]() { touched++; });
+    test_assert(id);
+
+    // move-only callables are destroyed after executing
+    std::unique_ptr<int> owned(new int(2));
+    int *raw = owned.get();
+    id = ex.execute([&touched, owned = std::move(owned)]() {
+        touched += *owned;
+    });
+    test_assert(id);
+    test_assert(!owned && *raw == 2);
+
+    equeue_dispatch(&q, 0);
+    test_assert(touched == 3);
+
+    equeue_destroy(&q);
+}
+
+void scheduler_test(void) {
+    equeue_t q;
+    int err = equeue_create(&q, 2048);
+    test_assert(!err);
+
+    events::scheduler sched(&q);
+    int values = 0;
+    int errors = 0;
+
+    auto op1 = sched.schedule().connect(receiver{&values, &errors});
+    auto op2 = sched.schedule_after(10).connect(receiver{&values, &errors});
+    op1.start();
+    op2.start();
+    test_assert(values == 0);
+
+    equeue_dispatch(&q, 0);
+    test_assert(values == 1);
+
+    equeue_dispatch(&q, 15);
+    test_assert(values == 2);
+    test_assert(errors == 0);
+
+    equeue_destroy(&q);
+
+    // out of memory is reported through the error channel
+    err = equeue_create(&q, 1);
+    test_assert(!err);
+
+    auto op3 = events::scheduler(&q).schedule().connect(
+            receiver{&values, &errors});
+    op3.start();
+    test_assert(errors == 1);
+
+    equeue_destroy(&q);
+}
+
+// Cyclic executive tests
+void cyclic_executive_test(void) {
+    equeue_t q;
+    int err = equeue_create(&q, 2048);
+    test_assert(!err);
+
+    int fast = 0;
+    int slow = 0;
+    int id = 0;
+    events::cyclic_executive exec(
+            events::every<10>([&fast]() { fast++; }),
+            events::every<20, 5>([&]() {
+                slow++;
+                if (slow == 3) {
+                    equeue_cancel(&q, id);
+                }
+            }));
+
+    typedef decltype(exec) schedule;
+    static_assert(schedule::hyperperiod == 20, "hyperperiod is the lcm");
+    static_assert(schedule::frame_count == 3, "empty frames are skipped");
+    static_assert(schedule::frames[0].tasks == 1 &&
+            schedule::frames[0].delay == 5, "first task at 0 ms");
+    static_assert(schedule::frames[1].tasks == 2 &&
+            schedule::frames[1].delay == 5, "second task at 5 ms");
+    static_assert(schedule::frames[2].tasks == 1 &&
+            schedule::frames[2].delay == 10, "first task again at 10 ms");
+
+    id = exec.start(&q);
+    test_assert(id);
+
+    // the slow task cancels the executive in the frame at 45 ms
+    equeue_dispatch(&q, 100);
+    test_assert(slow == 3);
+    test_assert(fast >= 4 && fast <= 6);
+
+    equeue_destroy(&q);
+}
+
+
+int main() {
+    printf("beginning tests...\n");
+
+    test_run(static_queue_sizing_test);
+    test_run(static_queue_call_test);
+    test_run(static_queue_alloc_test);
+    test_run(callable_event_test);
+    test_run(callable_event_throw_test);
+    test_run(static_queue_callable_test);
+    test_run(memory_resource_test);
+    test_run(executor_test);
+    test_run(scheduler_test);
+    test_run(cyclic_executive_test);
+
+    printf("done!\n");
+    return test_failure;
+}
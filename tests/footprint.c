@@ -0,0 +1,179 @@
+/*
+ * Memory footprint benchmark for the events library
+ *
+ * Copyright (c) 2016 Christopher Haster
+ * Distributed under the MIT license
+ */
+#include "equeue.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+
+// Size distributions
+#define FOOTPRINT_EVENTS 1000
+#define FOOTPRINT_CHURN 100000
+
+static uint32_t footprint_random(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static size_t call_size(uint32_t *state) {
+    // what equeue_call allocates
+    return 2*sizeof(void*);
+}
+
+static size_t small_size(uint32_t *state) {
+    return footprint_random(state) % 65;
+}
+
+static size_t bimodal_size(uint32_t *state) {
+    return (footprint_random(state) % 10) ? 16 : 256;
+}
+
+static size_t logscale_size(uint32_t *state) {
+    // roughly log-uniform between 8 and 1024 bytes
+    unsigned shift = 3 + footprint_random(state) % 7;
+    return (1 << shift) + footprint_random(state) % (1 << shift);
+}
+
+static size_t large_size(uint32_t *state) {
+    return 128 + footprint_random(state) % 385;
+}
+
+static const struct footprint_dist {
+    const char *name;
+    size_t (*size)(uint32_t *state);
+    size_t max;
+} footprint_dists[] = {
+    {"call",     call_size,     2*sizeof(void*)},
+    {"small",    small_size,    64},
+    {"bimodal",  bimodal_size,  256},
+    {"logscale", logscale_size, 1023},
+    {"large",    large_size,    512},
+};
+
+
+// Footprint measurement
+struct footprint_live {
+    void *e;
+    size_t size;
+};
+
+static size_t footprint_chunk(void *e) {
+    return ((struct equeue_event *)e - 1)->size;
+}
+
+static size_t footprint_aligned(size_t size) {
+    // what equeue_mem_alloc would carve for a fresh chunk
+    size += sizeof(struct equeue_event);
+    return (size + sizeof(void*)-1) & ~(sizeof(void*)-1);
+}
+
+static int footprint_measure(const struct footprint_dist *d) {
+    size_t buffer = 4 * FOOTPRINT_EVENTS * footprint_aligned(d->max);
+    equeue_t q;
+    int err = equeue_create(&q, buffer);
+    if (err) {
+        fprintf(stderr, "could not create a %zu byte event queue\n", buffer);
+        return 1;
+    }
+
+    uint32_t state = 0x9e3779b9;
+    struct footprint_live live[FOOTPRINT_EVENTS];
+    size_t requested = 0;
+    for (int i = 0; i < FOOTPRINT_EVENTS; i++) {
+        live[i].size = d->size(&state);
+        live[i].e = equeue_alloc(&q, live[i].size);
+        if (!live[i].e) {
+            fprintf(stderr, "could not allocate %d live events\n",
+                    FOOTPRINT_EVENTS);
+            equeue_destroy(&q);
+            return 1;
+        }
+        requested += live[i].size;
+    }
+
+    // fresh queue, split each chunk into payload, header and padding
+    size_t fresh = buffer - q.slab.size;
+    size_t header = FOOTPRINT_EVENTS * sizeof(struct equeue_event);
+    size_t padding = fresh - header - requested;
+
+    // churn at a constant number of live events, a slot that cannot even
+    // hold an empty event stays empty until it is picked again
+    unsigned failures = 0;
+    for (int i = 0; i < FOOTPRINT_CHURN; i++) {
+        struct footprint_live *l = &live[footprint_random(&state)
+                % FOOTPRINT_EVENTS];
+        if (l->e) {
+            equeue_dealloc(&q, l->e);
+        }
+        l->size = d->size(&state);
+        l->e = equeue_alloc(&q, l->size);
+        if (!l->e) {
+            failures += 1;
+            l->e = equeue_alloc(&q, 0);
+            l->size = 0;
+        }
+    }
+
+    // internal fragmentation, chunks reused first-fit are larger than needed
+    size_t used = 0;
+    size_t needed = 0;
+    for (int i = 0; i < FOOTPRINT_EVENTS; i++) {
+        if (live[i].e) {
+            used += footprint_chunk(live[i].e);
+            needed += footprint_aligned(live[i].size);
+        }
+    }
+
+    // external fragmentation, free chunks are never merged or split, so any
+    // memory below the high-water mark not used by a live event is stranded
+    // in chunks that only serve requests of the same size or smaller
+    size_t highwater = buffer - q.slab.size;
+    size_t stranded = 0;
+    for (struct equeue_event *c = q.chunks; c; c = c->next) {
+        for (struct equeue_event *s = c; s; s = s->sibling) {
+            stranded += s->size;
+        }
+    }
+    double external = 100.0 * stranded / highwater;
+
+    printf("%-9s %8.1f %8.1f %7.1f%% %7.1f%% %7.1f%% %10.1f %7.1f%% %8u\n",
+            d->name,
+            (double)requested / FOOTPRINT_EVENTS,
+            (double)fresh / FOOTPRINT_EVENTS,
+            100.0 * header / fresh,
+            100.0 * padding / fresh,
+            100.0 * (used - needed) / used,
+            (double)highwater / FOOTPRINT_EVENTS,
+            external,
+            failures);
+
+    equeue_destroy(&q);
+    return 0;
+}
+
+
+// Entry point
+int main() {
+    printf("%d live events, %d alloc/dealloc pairs of churn, "
+            "EQUEUE_EVENT_SIZE is %zu bytes\n",
+            FOOTPRINT_EVENTS, FOOTPRINT_CHURN, EQUEUE_EVENT_SIZE);
+    printf("%-9s %8s %8s %8s %8s %8s %10s %8s %8s\n",
+            "sizes", "payload", "fresh", "header", "padding",
+            "reuse", "highwater", "external", "failures");
+
+    for (size_t i = 0;
+            i < sizeof(footprint_dists)/sizeof(footprint_dists[0]); i++) {
+        int err = footprint_measure(&footprint_dists[i]);
+        if (err) {
+            return err;
+        }
+    }
+}
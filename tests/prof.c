@@ -4,6 +4,7 @@
  * Copyright (c) 2016 Christopher Haster
  * Distributed under the MIT license
  */
+#define _GNU_SOURCE
 #include "equeue.h"
 #include <unistd.h>
 #include <stdio.h>
@@ -11,7 +12,21 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <sys/time.h>
+#ifdef __linux__
+#include <string.h>
+#include <sys/socket.h>
+#endif
+
+#if defined(__linux__) && !defined(PROF_NOPERF)
+#define PROF_PERF
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
 
 
 // Performance measurement utils
@@ -35,17 +50,127 @@ static const char *prof_units;
     ((uint64_t)b << 32) | (uint64_t)a;                                      \
 })
 
+#ifdef PROF_PERF
+// Hardware performance counters, collected over the same regions as the
+// cycle counter. Counters the kernel refuses to open are left out, so
+// without perf_event_open support only cycles are reported.
+#define PROF_PERF_COUNTERS 4
+
+static const struct prof_perf_counter {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+} prof_perf_counters[PROF_PERF_COUNTERS] = {
+    {"instructions",     PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"cache-misses",     PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"branch-misses",    PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {"context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+};
+
+static int prof_perf_fds[PROF_PERF_COUNTERS];
+static int prof_perf_enabled;
+static double prof_perf_baseline[PROF_PERF_COUNTERS];
+
+static void prof_perf_open(void) {
+    for (int i = 0; i < PROF_PERF_COUNTERS; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = prof_perf_counters[i].type;
+        attr.config = prof_perf_counters[i].config;
+        attr.disabled = 1;
+        attr.exclude_hv = 1;
+        // context switches are only ever counted in the kernel
+        attr.exclude_kernel = (attr.type == PERF_TYPE_HARDWARE);
+
+        prof_perf_fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (prof_perf_fds[i] >= 0) {
+            prof_perf_enabled = 1;
+        }
+    }
+}
+
+static void prof_perf_reset(void) {
+    for (int i = 0; i < PROF_PERF_COUNTERS; i++) {
+        if (prof_perf_fds[i] >= 0) {
+            ioctl(prof_perf_fds[i], PERF_EVENT_IOC_RESET, 0);
+        }
+    }
+}
+
+static prof_cycle_t prof_perf_runs[PROF_RUNS][PROF_PERF_COUNTERS];
+static double prof_perf_result[PROF_PERF_COUNTERS];
+
+static void prof_perf_read(int run) {
+    for (int i = 0; i < PROF_PERF_COUNTERS; i++) {
+        uint64_t count = 0;
+        if (prof_perf_fds[i] >= 0 &&
+                read(prof_perf_fds[i], &count, sizeof(count)) != sizeof(count)) {
+            count = 0;
+        }
+        prof_perf_runs[run][i] = count;
+    }
+}
+
+static void prof_perf_report(int run) {
+    // counts are reported per iteration for the run with the fewest cycles
+    for (int i = 0; i < PROF_PERF_COUNTERS; i++) {
+        prof_perf_result[i] = (double)prof_perf_runs[run][i]
+                / prof_iterations - prof_perf_baseline[i];
+    }
+
+    if (!prof_perf_enabled || strcmp(prof_units, "cycles") != 0) {
+        return;
+    }
+
+    for (int i = 0; i < PROF_PERF_COUNTERS; i++) {
+        if (prof_perf_fds[i] >= 0) {
+            printf(", %.2f %s",
+                    prof_perf_result[i] > 0 ? prof_perf_result[i] : 0,
+                    prof_perf_counters[i].name);
+        }
+    }
+}
+
+static void prof_perf_rebase(void) {
+    memcpy(prof_perf_baseline, prof_perf_result, sizeof(prof_perf_baseline));
+}
+
+// one prctl toggles every counter owned by this thread
+#define prof_perf_enable() ({                                               \
+    if (prof_perf_enabled) {                                                \
+        prctl(PR_TASK_PERF_EVENTS_ENABLE);                                  \
+    }                                                                       \
+})
+
+#define prof_perf_disable() ({                                              \
+    if (prof_perf_enabled) {                                                \
+        prctl(PR_TASK_PERF_EVENTS_DISABLE);                                 \
+    }                                                                       \
+})
+#else
+#define prof_perf_open() ((void)0)
+#define prof_perf_reset() ((void)0)
+#define prof_perf_read(run) ((void)0)
+#define prof_perf_report(run) ((void)0)
+#define prof_perf_rebase() ((void)0)
+#define prof_perf_enable() ((void)0)
+#define prof_perf_disable() ((void)0)
+#endif
+
 #define prof_loop()                                                         \
     for (prof_iterations = 0;                                               \
          prof_accum_cycle < PROF_INTERVAL;                                  \
          prof_iterations++)
 
 #define prof_start() ({                                                     \
+    prof_perf_enable();                                                     \
     prof_start_cycle = prof_cycle();                                        \
 })
 
 #define prof_stop() ({                                                      \
     prof_stop_cycle = prof_cycle();                                         \
+    prof_perf_disable();                                                    \
     prof_accum_cycle += prof_stop_cycle - prof_start_cycle;                 \
 })
 
@@ -61,25 +186,34 @@ static const char *prof_units;
                                                                             \
     prof_units = "cycles";                                                  \
     prof_cycle_t runs[PROF_RUNS];                                           \
+    prof_cycle_t iterations[PROF_RUNS];                                     \
     for (int i = 0; i < PROF_RUNS; i++) {                                   \
         prof_accum_cycle = 0;                                               \
         prof_iterations = 0;                                                \
+        prof_perf_reset();                                                  \
         func(__VA_ARGS__);                                                  \
+        prof_perf_read(i);                                                  \
         runs[i] = prof_accum_cycle / prof_iterations;                       \
+        iterations[i] = prof_iterations;                                    \
     }                                                                       \
                                                                             \
-    prof_cycle_t res = runs[0];                                             \
+    int best = 0;                                                           \
     for (int i = 0; i < PROF_RUNS; i++) {                                   \
-        if (runs[i] < res) {                                                \
-            res = runs[i];                                                  \
+        if (runs[i] < runs[best]) {                                         \
+            best = i;                                                       \
         }                                                                   \
     }                                                                       \
-    res -= prof_baseline_cycle;                                             \
+    prof_cycle_t res = runs[best] - prof_baseline_cycle;                    \
+    prof_iterations = iterations[best];                                     \
     printf("\r%s: %"PRIu64" %s", #func, res, prof_units);                   \
                                                                             \
+    prof_cycle_t prev = 0;                                                  \
     if (!isatty(0)) {                                                       \
-        prof_cycle_t prev;                                                  \
         while (scanf("%*[^0-9]%"PRIu64, &prev) == 0);                       \
+        scanf("%*[^\n]");                                                   \
+    }                                                                       \
+                                                                            \
+    if (prev) {                                                             \
         int64_t perc = 100*((int64_t)prev - (int64_t)res) / (int64_t)prev;  \
                                                                             \
         if (perc > 10) {                                                    \
@@ -91,6 +225,7 @@ static const char *prof_units;
         }                                                                   \
     }                                                                       \
                                                                             \
+    prof_perf_report(best);                                                 \
     printf("\n");                                                           \
     res;                                                                    \
 })
@@ -98,6 +233,7 @@ static const char *prof_units;
 #define prof_baseline(func, ...) ({                                         \
     prof_baseline_cycle = 0;                                                \
     prof_baseline_cycle = prof_measure(func, __VA_ARGS__);                  \
+    prof_perf_rebase();                                                     \
 })
 
 
@@ -308,6 +444,158 @@ void equeue_cancel_many_prof(int count) {
     equeue_destroy(&q);
 }
 
+void equeue_single_post_prof(void) {
+    struct equeue q;
+    equeue_create(&q, EQUEUE_EVENT_SIZE);
+    equeue_single_thread(&q, true);
+
+    prof_loop() {
+        void *e = equeue_alloc(&q, 0);
+
+        prof_start();
+        int id = equeue_post(&q, no_func, e);
+        prof_stop();
+
+        equeue_cancel(&q, id);
+    }
+
+    equeue_destroy(&q);
+}
+
+void equeue_single_dispatch_prof(void) {
+    struct equeue q;
+    equeue_create(&q, EQUEUE_EVENT_SIZE);
+    equeue_single_thread(&q, true);
+
+    prof_loop() {
+        equeue_call(&q, no_func, 0);
+
+        prof_start();
+        equeue_dispatch(&q, 0);
+        prof_stop();
+    }
+
+    equeue_destroy(&q);
+}
+
+void equeue_single_call_dispatch_prof(int single) {
+    struct equeue q;
+    equeue_create(&q, EQUEUE_EVENT_SIZE);
+    equeue_single_thread(&q, single);
+
+    // the whole round trip of an event
+    prof_loop() {
+        prof_start();
+        equeue_call(&q, no_func, 0);
+        equeue_dispatch(&q, 0);
+        prof_stop();
+    }
+
+    equeue_destroy(&q);
+}
+
+void *equeue_dispatch_thread(void *p) {
+    equeue_dispatch((equeue_t *)p, -1);
+    return 0;
+}
+
+void equeue_post_waiting_prof(int window) {
+    struct equeue q;
+    equeue_create(&q, 1000*EQUEUE_EVENT_SIZE);
+    equeue_moderate(&q, window);
+
+    pthread_t thread;
+    pthread_create(&thread, 0, equeue_dispatch_thread, &q);
+
+    // posts to a dispatch loop running in another thread
+    prof_loop() {
+        void *e;
+        while (!(e = equeue_alloc(&q, 0))) {
+            usleep(100);
+        }
+
+        prof_start();
+        equeue_post(&q, no_func, e);
+        prof_stop();
+    }
+
+    equeue_break(&q);
+    pthread_join(thread, 0);
+    equeue_destroy(&q);
+}
+
+#ifdef __linux__
+#define PROF_DATAGRAM 64
+
+void recv_post_many_prof(int count) {
+    struct equeue q;
+    equeue_create(&q, 2*count*(EQUEUE_EVENT_SIZE + PROF_DATAGRAM));
+
+    int sv[2];
+    socketpair(AF_UNIX, SOCK_DGRAM, 0, sv);
+    char datagram[PROF_DATAGRAM] = {0};
+
+    prof_loop() {
+        for (int i = 0; i < count; i++) {
+            send(sv[1], datagram, sizeof(datagram), 0);
+        }
+
+        // what a helper thread does, receive then copy into an event
+        prof_start();
+        for (int i = 0; i < count; i++) {
+            char buffer[PROF_DATAGRAM];
+            ssize_t size = recv(sv[0], buffer, sizeof(buffer), MSG_DONTWAIT);
+            void *e = equeue_alloc(&q, size);
+            memcpy(e, buffer, size);
+            equeue_post(&q, no_func, e);
+        }
+        prof_stop();
+
+        equeue_dispatch(&q, 0);
+    }
+
+    close(sv[0]);
+    close(sv[1]);
+    equeue_destroy(&q);
+}
+
+void no_datagram_func(void *p, struct equeue_datagram *d) {
+}
+
+void equeue_source_recv_many_prof(int count) {
+    struct equeue q;
+    equeue_create(&q, 2*count*(EQUEUE_EVENT_SIZE + PROF_DATAGRAM +
+            sizeof(struct equeue_datagram)));
+
+    int sv[2];
+    socketpair(AF_UNIX, SOCK_DGRAM, 0, sv);
+    char datagram[PROF_DATAGRAM] = {0};
+
+    equeue_source_t source;
+    equeue_source_recv(&source, &q, sv[0], PROF_DATAGRAM,
+            no_datagram_func, 0);
+    equeue_sema_wait(&q.eventsema, 0);
+
+    prof_loop() {
+        for (int i = 0; i < count; i++) {
+            send(sv[1], datagram, sizeof(datagram), 0);
+        }
+
+        // what the dispatch thread does when the socket is readable
+        prof_start();
+        equeue_sema_wait(&q.eventsema, 0);
+        prof_stop();
+
+        equeue_dispatch(&q, 0);
+    }
+
+    equeue_source_destroy(&source);
+    close(sv[0]);
+    close(sv[1]);
+    equeue_destroy(&q);
+}
+#endif
+
 void equeue_alloc_size_prof(void) {
     size_t size = 32*EQUEUE_EVENT_SIZE;
 
@@ -373,6 +661,7 @@ void equeue_alloc_fragmented_size_prof(int count) {
 int main() {
     printf("beginning profiling...\n");
 
+    prof_perf_open();
     prof_baseline(baseline_prof);
 
     prof_measure(equeue_tick_prof);
@@ -381,12 +670,22 @@ int main() {
     prof_measure(equeue_post_future_prof);
     prof_measure(equeue_dispatch_prof);
     prof_measure(equeue_cancel_prof);
+    prof_measure(equeue_single_post_prof);
+    prof_measure(equeue_single_dispatch_prof);
+    prof_measure(equeue_single_call_dispatch_prof, 0);
+    prof_measure(equeue_single_call_dispatch_prof, 1);
 
     prof_measure(equeue_alloc_many_prof, 1000);
     prof_measure(equeue_post_many_prof, 1000);
     prof_measure(equeue_post_future_many_prof, 1000);
     prof_measure(equeue_dispatch_many_prof, 100);
     prof_measure(equeue_cancel_many_prof, 100);
+    prof_measure(equeue_post_waiting_prof, 0);
+    prof_measure(equeue_post_waiting_prof, 1);
+#ifdef __linux__
+    prof_measure(recv_post_many_prof, 16);
+    prof_measure(equeue_source_recv_many_prof, 16);
+#endif
 
     prof_measure(equeue_alloc_size_prof);
     prof_measure(equeue_alloc_many_size_prof, 1000);
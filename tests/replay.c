@@ -0,0 +1,231 @@
+/*
+ * Operation log replay for the events library
+ *
+ * Copyright (c) 2016 Christopher Haster
+ * Distributed under the MIT license
+ */
+#include "equeue.h"
+#include <unistd.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+// Replay configuration
+static struct replay_config {
+    int realtime;
+    unsigned buffer;
+} config = {
+    .realtime = 0,
+    .buffer = 1024*1024,
+};
+
+static void replay_usage(const char *name) {
+    fprintf(stderr,
+        "usage: %s [options] log\n"
+        "  -r             replay in real time instead of as fast as possible\n"
+        "  -b bytes       event queue buffer size (%u)\n",
+        name, config.buffer);
+    exit(1);
+}
+
+
+// Cost accounting
+struct replay_cost {
+    const char *name;
+    unsigned long long ops;
+    unsigned long long ns;
+};
+
+static struct replay_cost replay_alloc = {"alloc"};
+static struct replay_cost replay_post = {"post"};
+static struct replay_cost replay_cancel = {"cancel"};
+static struct replay_cost replay_dispatch = {"dispatch"};
+
+static unsigned long long replay_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+static void replay_report(const struct replay_cost *c, const char *per) {
+    printf("%-8s %10llu ops, %8.1f ns/%s\n", c->name, c->ops,
+            c->ops ? (double)c->ns / c->ops : 0.0, per);
+}
+
+
+// Recorded ids are mapped to replayed ids with open addressing, recorded
+// ids are reused by the queue so later posts replace earlier mappings
+struct replay_id {
+    int32_t recorded;
+    int replayed;
+};
+
+static struct replay_id *replay_ids;
+static unsigned replay_nids;
+
+static struct replay_id *replay_lookup(int32_t recorded) {
+    unsigned i = ((uint32_t)recorded * 2654435761u) & (replay_nids-1);
+    while (replay_ids[i].recorded && replay_ids[i].recorded != recorded) {
+        i = (i + 1) & (replay_nids-1);
+    }
+
+    return &replay_ids[i];
+}
+
+
+// Replay
+static equeue_t q;
+static unsigned long long replay_executed;
+
+static void replay_func(void *p) {
+    replay_executed += 1;
+}
+
+static void replay_run(unsigned long long now) {
+    // run whatever is due, in real time also wait for the next record
+    unsigned long long start = replay_ns();
+    int ms = 0;
+    if (config.realtime && now > start) {
+        ms = (now - start) / 1000000;
+    }
+
+    equeue_dispatch(&q, ms);
+    if (!ms) {
+        replay_dispatch.ns += replay_ns() - start;
+        replay_dispatch.ops += 1;
+    }
+
+    while (config.realtime && replay_ns() < now);
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "rb:h")) != -1) {
+        switch (opt) {
+            case 'r': config.realtime = 1; break;
+            case 'b': config.buffer = strtoul(optarg, 0, 0); break;
+            default: replay_usage(argv[0]);
+        }
+    }
+
+    if (optind != argc-1) {
+        replay_usage(argv[0]);
+    }
+
+    FILE *f = fopen(argv[optind], "rb");
+    if (!f) {
+        fprintf(stderr, "could not open %s\n", argv[optind]);
+        return 1;
+    }
+
+    char magic[sizeof(EQUEUE_LOG_MAGIC)];
+    if (fread(magic, sizeof(magic), 1, f) != 1 ||
+            memcmp(magic, EQUEUE_LOG_MAGIC, sizeof(magic)) != 0) {
+        fprintf(stderr, "%s is not an equeue operation log\n", argv[optind]);
+        return 1;
+    }
+
+    // load the whole log so file io stays out of the measurements
+    long offset = ftell(f);
+    fseek(f, 0, SEEK_END);
+    size_t count = (ftell(f) - offset) / sizeof(struct equeue_log_record);
+    fseek(f, offset, SEEK_SET);
+
+    struct equeue_log_record *records = malloc(
+            (count ? count : 1) * sizeof(struct equeue_log_record));
+    count = fread(records, sizeof(struct equeue_log_record), count, f);
+    fclose(f);
+
+    replay_nids = 1;
+    while (replay_nids < 2*count) {
+        replay_nids <<= 1;
+    }
+    replay_ids = calloc(replay_nids, sizeof(struct replay_id));
+
+    int err = equeue_create(&q, config.buffer);
+    if (err) {
+        fprintf(stderr, "could not create a %u byte event queue\n",
+                config.buffer);
+        return 1;
+    }
+
+    unsigned long long failures = 0;
+    unsigned long long recorded = 0;
+    unsigned long long drain = 0;
+    unsigned long long start = replay_ns();
+
+    for (size_t i = 0; i < count; i++) {
+        const struct equeue_log_record *r = &records[i];
+        if (i > 0) {
+            recorded += (uint32_t)(r->time - records[i-1].time);
+        }
+        replay_run(start + recorded*1000);
+
+        if (r->type == EQUEUE_LOG_POST) {
+            unsigned long long t = replay_ns();
+            void *e = equeue_alloc(&q, r->size);
+            replay_alloc.ns += replay_ns() - t;
+            replay_alloc.ops += 1;
+
+            struct replay_id *id = replay_lookup(r->id);
+            id->recorded = r->id;
+            id->replayed = 0;
+            if (!e) {
+                failures += 1;
+                continue;
+            }
+
+            equeue_event_delay(e, r->delay);
+            equeue_event_period(e, r->period);
+
+            t = replay_ns();
+            id->replayed = equeue_post(&q, replay_func, e);
+            replay_post.ns += replay_ns() - t;
+            replay_post.ops += 1;
+
+            unsigned long long due = t + (unsigned long long)r->delay*1000000;
+            if (due > drain) {
+                drain = due;
+            }
+        } else if (r->type == EQUEUE_LOG_CANCEL) {
+            struct replay_id *id = replay_lookup(r->id);
+            int replayed = (id->recorded == r->id) ? id->replayed : 0;
+
+            unsigned long long t = replay_ns();
+            equeue_cancel(&q, replayed);
+            replay_cancel.ns += replay_ns() - t;
+            replay_cancel.ops += 1;
+        }
+    }
+    unsigned long long elapsed = replay_ns() - start;
+
+    // the dispatch clock is real, so as fast as possible few delayed events
+    // come due during the replay, wait for the rest without timing them
+    unsigned long long executed = replay_executed;
+    unsigned long long now = replay_ns();
+    equeue_dispatch(&q, drain > now ? (drain - now) / 1000000 + 1 : 0);
+
+    printf("log: %zu records over %.3f s, replayed in %.3f s%s\n",
+            count, recorded / 1e6, elapsed / 1e9,
+            config.realtime ? " in real time" : "");
+    printf("events: %llu executed, %llu after the replay, "
+            "%llu alloc failures, %u of %u bytes high-water\n",
+            replay_executed, replay_executed - executed, failures,
+            (unsigned)(config.buffer - q.slab.size), config.buffer);
+    replay_report(&replay_alloc, "op");
+    replay_report(&replay_post, "op");
+    replay_report(&replay_cancel, "op");
+    if (!config.realtime) {
+        replay_report(&replay_dispatch, "call");
+        printf("dispatch excludes the expiry of events left for after the "
+                "replay\n");
+    }
+
+    free(replay_ids);
+    free(records);
+    equeue_destroy(&q);
+    return 0;
+}
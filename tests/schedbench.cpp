@@ -0,0 +1,411 @@
+/*
+ * Comparison of the equeue scheduler against reference schedulers
+ *
+ * Copyright (c) 2016 Christopher Haster
+ * Distributed under the MIT license
+ */
+#include "equeue.h"
+#include <unistd.h>
+#include <stdio.h>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <random>
+#include <vector>
+
+
+// Reference schedulers
+//
+// Each scheduler keeps timers against a virtual clock in milliseconds and
+// provides schedule, cancel, advance, expire and an estimate of the bytes
+// it uses for pending timers. Advance is not timed, it lets the equeue
+// scheduler wait for the real clock. Node allocations are counted by their
+// size, without the malloc header.
+namespace {
+
+void timer_func(void *) {
+}
+
+// Binary heap of timer nodes, each node tracks its index for cancellation
+class heap_scheduler {
+public:
+    struct node {
+        unsigned target;
+        size_t index;
+        void (*cb)(void *);
+    };
+    typedef node *handle;
+
+    handle schedule(unsigned delay) {
+        node *n = new node{_now + delay, _heap.size(), timer_func};
+        _heap.push_back(n);
+        sift_up(n->index);
+        return n;
+    }
+
+    void cancel(handle n) {
+        size_t i = n->index;
+        swap(i, _heap.size()-1);
+        _heap.pop_back();
+        if (i < _heap.size()) {
+            sift_up(i);
+            sift_down(i);
+        }
+        delete n;
+    }
+
+    void advance(unsigned) {
+    }
+
+    size_t expire(unsigned now) {
+        _now = now;
+        size_t count = 0;
+        while (!_heap.empty() && _heap[0]->target <= now) {
+            node *n = _heap[0];
+            swap(0, _heap.size()-1);
+            _heap.pop_back();
+            sift_down(0);
+            n->cb(0);
+            delete n;
+            count += 1;
+        }
+        return count;
+    }
+
+    size_t bytes() const {
+        return _heap.size()*sizeof(node) + _heap.capacity()*sizeof(node *);
+    }
+
+private:
+    void swap(size_t a, size_t b) {
+        std::swap(_heap[a], _heap[b]);
+        _heap[a]->index = a;
+        _heap[b]->index = b;
+    }
+
+    void sift_up(size_t i) {
+        while (i > 0 && _heap[(i-1)/2]->target > _heap[i]->target) {
+            swap(i, (i-1)/2);
+            i = (i-1)/2;
+        }
+    }
+
+    void sift_down(size_t i) {
+        while (true) {
+            size_t min = i;
+            for (size_t c = 2*i+1; c <= 2*i+2 && c < _heap.size(); c++) {
+                if (_heap[c]->target < _heap[min]->target) {
+                    min = c;
+                }
+            }
+            if (min == i) {
+                return;
+            }
+            swap(i, min);
+            i = min;
+        }
+    }
+
+    std::vector<node *> _heap;
+    unsigned _now = 0;
+};
+
+// Allocator that counts the bytes of the container's nodes
+static size_t counted_bytes;
+
+template <typename T>
+struct counting_allocator {
+    typedef T value_type;
+
+    counting_allocator() = default;
+    template <typename U>
+    counting_allocator(const counting_allocator<U> &) {}
+
+    T *allocate(size_t n) {
+        counted_bytes += n*sizeof(T);
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T *p, size_t n) {
+        counted_bytes -= n*sizeof(T);
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    template <typename U>
+    bool operator==(const counting_allocator<U> &) const { return true; }
+    template <typename U>
+    bool operator!=(const counting_allocator<U> &) const { return false; }
+};
+
+// Red-black tree from the standard library
+class multimap_scheduler {
+public:
+    typedef std::multimap<unsigned, void (*)(void *), std::less<unsigned>,
+            counting_allocator<std::pair<const unsigned, void (*)(void *)>>>
+            map;
+    typedef map::iterator handle;
+
+    multimap_scheduler() {
+        counted_bytes = 0;
+    }
+
+    handle schedule(unsigned delay) {
+        return _map.emplace(_now + delay, timer_func);
+    }
+
+    void cancel(handle h) {
+        _map.erase(h);
+    }
+
+    void advance(unsigned) {
+    }
+
+    size_t expire(unsigned now) {
+        _now = now;
+        size_t count = 0;
+        auto end = _map.upper_bound(now);
+        for (auto i = _map.begin(); i != end; i = _map.erase(i)) {
+            i->second(0);
+            count += 1;
+        }
+        return count;
+    }
+
+    size_t bytes() const {
+        return counted_bytes;
+    }
+
+private:
+    map _map;
+    unsigned _now = 0;
+};
+
+// Hashed timing wheel with one slot per millisecond, timers further out
+// than a revolution count the remaining rounds
+class wheel_scheduler {
+public:
+    static const unsigned slots = 256;
+
+    struct node {
+        node *next;
+        node **ref;
+        unsigned rounds;
+        void (*cb)(void *);
+    };
+    typedef node *handle;
+
+    wheel_scheduler() : _slots(slots, nullptr) {}
+
+    ~wheel_scheduler() {
+        for (node *head : _slots) {
+            while (head) {
+                node *n = head;
+                head = n->next;
+                delete n;
+            }
+        }
+    }
+
+    handle schedule(unsigned delay) {
+        // the slot is next visited within a revolution, then every revolution
+        delay = delay ? delay : 1;
+        unsigned target = _now + delay;
+        node *n = new node{nullptr, nullptr, (delay-1) / slots, timer_func};
+        node **p = &_slots[target % slots];
+        n->next = *p;
+        if (n->next) {
+            n->next->ref = &n->next;
+        }
+        *p = n;
+        n->ref = p;
+        _count += 1;
+        return n;
+    }
+
+    void cancel(handle n) {
+        unlink(n);
+        delete n;
+    }
+
+    void advance(unsigned) {
+    }
+
+    size_t expire(unsigned now) {
+        size_t count = 0;
+        while (_now != now) {
+            _now += 1;
+            for (node *n = _slots[_now % slots], *next; n; n = next) {
+                next = n->next;
+                if (n->rounds) {
+                    n->rounds -= 1;
+                    continue;
+                }
+                unlink(n);
+                n->cb(0);
+                delete n;
+                count += 1;
+            }
+        }
+        return count;
+    }
+
+    size_t bytes() const {
+        return _count*sizeof(node) + slots*sizeof(node *);
+    }
+
+private:
+    void unlink(node *n) {
+        *n->ref = n->next;
+        if (n->next) {
+            n->next->ref = n->ref;
+        }
+        _count -= 1;
+    }
+
+    std::vector<node *> _slots;
+    size_t _count = 0;
+    unsigned _now = 0;
+};
+
+// The equeue scheduler against the real clock
+class equeue_scheduler {
+public:
+    typedef int handle;
+
+    static void count_func(void *p) {
+        **(size_t **)p += 1;
+    }
+
+    explicit equeue_scheduler(size_t count) {
+        _size = count*EQUEUE_EVENT_SIZE;
+        equeue_create(&_q, _size);
+    }
+
+    ~equeue_scheduler() {
+        equeue_destroy(&_q);
+    }
+
+    handle schedule(unsigned delay) {
+        void *e = equeue_alloc(&_q, sizeof(size_t *));
+        equeue_event_delay(e, delay);
+        *(size_t **)e = &_count;
+        return equeue_post(&_q, count_func, e);
+    }
+
+    void cancel(handle id) {
+        equeue_cancel(&_q, id);
+    }
+
+    void advance(unsigned now) {
+        // wait for the real clock to catch up with the virtual one
+        usleep((now+1)*1000);
+    }
+
+    size_t expire(unsigned) {
+        size_t count = _count;
+        equeue_dispatch(&_q, 0);
+        return _count - count;
+    }
+
+    size_t bytes() const {
+        return _size - _q.slab.size;
+    }
+
+private:
+    equeue_t _q;
+    size_t _size;
+    size_t _count = 0;
+};
+
+
+// Benchmark driver
+#define SCHEDBENCH_DELAY 1000
+#define SCHEDBENCH_OPS 200000
+
+typedef std::chrono::steady_clock bench_clock;
+
+static double elapsed_ns(bench_clock::time_point start, size_t ops) {
+    return std::chrono::duration<double, std::nano>(
+            bench_clock::now() - start).count() / ops;
+}
+
+template <typename S>
+static void schedbench(const char *name, S &s, size_t pending) {
+    std::mt19937 rand(pending);
+    std::uniform_int_distribution<unsigned> delays(1, SCHEDBENCH_DELAY);
+    std::vector<typename S::handle> handles;
+    std::vector<size_t> order;
+    handles.reserve(pending);
+    order.reserve(pending);
+
+    for (size_t i = 0; i < pending; i++) {
+        handles.push_back(s.schedule(delays(rand)));
+        order.push_back(i);
+    }
+    double bytes = (double)s.bytes() / pending;
+
+    // churn at a constant number of pending timers, cancelling and
+    // rescheduling batches of distinct random timers
+    size_t batch = pending < 1024 ? pending : 1024;
+    double schedule = 0;
+    double cancel = 0;
+    size_t rounds = SCHEDBENCH_OPS / batch;
+    for (size_t r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < batch; i++) {
+            std::swap(order[i], order[i + rand() % (pending - i)]);
+        }
+
+        auto start = bench_clock::now();
+        for (size_t i = 0; i < batch; i++) {
+            s.cancel(handles[order[i]]);
+        }
+        cancel += elapsed_ns(start, batch);
+
+        start = bench_clock::now();
+        for (size_t i = 0; i < batch; i++) {
+            handles[order[i]] = s.schedule(delays(rand));
+        }
+        schedule += elapsed_ns(start, batch);
+    }
+
+    // expire everything that is pending
+    s.advance(SCHEDBENCH_DELAY);
+    auto start = bench_clock::now();
+    size_t expired = s.expire(SCHEDBENCH_DELAY);
+    double expire = elapsed_ns(start, pending);
+    if (expired != pending) {
+        fprintf(stderr, "%s: expired %zu of %zu timers\n",
+                name, expired, pending);
+    }
+
+    printf("%-14s %8zu %12.1f %12.1f %12.1f %12.1f\n", name, pending,
+            schedule / rounds, cancel / rounds, expire, bytes);
+}
+
+}
+
+
+// Entry point
+int main() {
+    printf("%-14s %8s %12s %12s %12s %12s\n", "scheduler", "pending",
+            "schedule ns", "cancel ns", "expire ns", "bytes/timer");
+
+    for (size_t pending = 16; pending <= 16384; pending *= 8) {
+        {
+            equeue_scheduler s(pending + 1024);
+            schedbench("equeue", s, pending);
+        }
+        {
+            heap_scheduler s;
+            schedbench("binary heap", s, pending);
+        }
+        {
+            multimap_scheduler s;
+            schedbench("std::multimap", s, pending);
+        }
+        {
+            wheel_scheduler s;
+            schedbench("timing wheel", s, pending);
+        }
+    }
+}
@@ -10,7 +10,16 @@
 #include <setjmp.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
+#ifdef __linux__
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#endif
 
 
 // Testing setup
@@ -185,6 +194,53 @@ void simple_post_test(void) {
     equeue_destroy(&q);
 }
 
+struct order {
+    int *log;
+    int *count;
+    int value;
+};
+
+void order_func(void *p) {
+    struct order *o = (struct order *)p;
+    o->log[(*o->count)++] = o->value;
+}
+
+void post_batch_test(void) {
+    equeue_t q;
+    int err = equeue_create(&q, 2048);
+    test_assert(!err);
+
+    int log[8];
+    int count = 0;
+    void *events[8];
+    int ids[8];
+    for (int i = 0; i < 8; i++) {
+        struct order *o = equeue_alloc(&q, sizeof(struct order));
+        test_assert(o);
+        o->log = log;
+        o->count = &count;
+        o->value = i;
+        equeue_event_delay(o, (i % 2) ? 10 : 0);
+        events[i] = o;
+    }
+
+    equeue_post_batch(&q, order_func, events, 8, ids);
+    for (int i = 0; i < 8; i++) {
+        test_assert(ids[i]);
+    }
+
+    equeue_cancel(&q, ids[3]);
+    equeue_dispatch(&q, 20);
+
+    int expected[] = {0, 2, 4, 6, 1, 5, 7};
+    test_assert(count == 7);
+    for (int i = 0; i < 7; i++) {
+        test_assert(log[i] == expected[i]);
+    }
+
+    equeue_destroy(&q);
+}
+
 // Misc tests
 void destructor_test(void) {
     equeue_t q;
@@ -258,6 +314,60 @@ void allocation_failure_test(void) {
     equeue_destroy(&q);
 }
 
+void realloc_test(void) {
+    equeue_t q;
+    int err = equeue_create(&q, 2048);
+    test_assert(!err);
+
+    // the most recent chunk grows and shrinks against the slab
+    char *a = equeue_alloc(&q, 8);
+    char *b = equeue_alloc(&q, 8);
+    test_assert(a && b);
+    size_t slab = q.slab.size;
+
+    test_assert(equeue_realloc(&q, b, 256) == b);
+    test_assert(q.slab.size < slab);
+    test_assert(equeue_realloc(&q, b, 8) == b);
+    test_assert(q.slab.size == slab);
+
+    // other chunks move when they grow, keeping contents and destructor
+    int touched = 0;
+    struct indirect *i = (struct indirect *)a;
+    i->touched = &touched;
+    equeue_event_dtor(i, indirect_func);
+
+    struct indirect *n = equeue_realloc(&q, i, 128);
+    test_assert(n && n != i);
+    test_assert(n->touched == &touched);
+    test_assert(equeue_alloc(&q, 8) == a);
+
+    int id = equeue_post(&q, pass_func, n);
+    test_assert(id);
+    equeue_dispatch(&q, 0);
+    test_assert(touched == 1);
+
+    // shrinking splits off the tail for later allocations
+    char *c = equeue_alloc(&q, 512);
+    char *d = equeue_alloc(&q, 256);
+    test_assert(c && d);
+    memset(c, 0x5a, 512);
+
+    test_assert(equeue_realloc(&q, c, 16) == c);
+    slab = q.slab.size;
+    char *e = equeue_alloc(&q, 256);
+    test_assert(e > c && e < d);
+    test_assert(q.slab.size == slab);
+    for (int j = 0; j < 16; j++) {
+        test_assert(c[j] == 0x5a);
+    }
+
+    // failure leaves the event untouched
+    test_assert(!equeue_realloc(&q, d, 4096));
+    test_assert(equeue_realloc(&q, d, 0) == d);
+
+    equeue_destroy(&q);
+}
+
 void cancel_test(int N) {
     equeue_t q;
     int err = equeue_create(&q, 2048);
@@ -317,6 +427,28 @@ void cancel_inflight_test(void) {
     equeue_destroy(&q);
 }
 
+void cancel_sibling_test(void) {
+    equeue_t q;
+    int err = equeue_create(&q, 2048);
+    test_assert(!err);
+
+    // the oldest of several events in the same slot is the last sibling
+    int touched = 0;
+    equeue_call_in(&q, 200, simple_func, &touched);
+    int id = equeue_call_in(&q, 100, simple_func, &touched);
+    equeue_call_in(&q, 100, simple_func, &touched);
+    equeue_call_in(&q, 100, simple_func, &touched);
+    equeue_cancel(&q, id);
+
+    equeue_dispatch(&q, 150);
+    test_assert(touched == 2);
+
+    equeue_dispatch(&q, 100);
+    test_assert(touched == 3);
+
+    equeue_destroy(&q);
+}
+
 void cancel_unnecessarily_test(void) {
     equeue_t q;
     int err = equeue_create(&q, 2048);
@@ -452,6 +584,39 @@ void sloth_test(void) {
     equeue_destroy(&q);
 }
 
+void single_thread_test(void) {
+    equeue_t q;
+    int err = equeue_create(&q, 2048);
+    test_assert(!err);
+    equeue_single_thread(&q, true);
+
+    int touched = 0;
+    equeue_call(&q, simple_func, &touched);
+    equeue_call_in(&q, 10, simple_func, &touched);
+    int id = equeue_call_in(&q, 10, simple_func, &touched);
+    test_assert(id);
+    equeue_cancel(&q, id);
+
+    // events posted from callbacks are dispatched without a signal
+    struct nest *nest = equeue_alloc(&q, sizeof(struct nest));
+    test_assert(nest);
+    nest->q = &q;
+    nest->cb = simple_func;
+    nest->data = &touched;
+    id = equeue_post(&q, nest_func, nest);
+    test_assert(id);
+
+    equeue_dispatch(&q, 30);
+    test_assert(touched == 3);
+
+    equeue_call_every(&q, 5, simple_func, &touched);
+    equeue_call_in(&q, 22, (void (*)(void *))equeue_break, &q);
+    equeue_dispatch(&q, -1);
+    test_assert(touched >= 6);
+
+    equeue_destroy(&q);
+}
+
 void *multithread_thread(void *p) {
     equeue_t *q = (equeue_t *)p;
     equeue_dispatch(q, -1);
@@ -480,6 +645,58 @@ void multithread_test(void) {
     equeue_destroy(&q);
 }
 
+struct moderate {
+    equeue_t *q;
+    int step;
+    bool signalled;
+};
+
+void moderate_func(void *p) {
+    struct moderate *m = (struct moderate *)p;
+    m->step += 1;
+    if (m->step < 3) {
+        equeue_call(m->q, moderate_func, m);
+    }
+
+    // the second step runs right after a batch, so its post is moderated
+    if (m->step == 2) {
+        m->signalled = equeue_sema_wait(&m->q->eventsema, 0);
+    } else if (m->step == 3) {
+        equeue_break(m->q);
+    }
+}
+
+void moderate_test(void) {
+    equeue_t q;
+    int err = equeue_create(&q, 2048);
+    test_assert(!err);
+
+    // without moderation every post signals the dispatch loop
+    struct moderate m = {&q, 0, false};
+    equeue_call(&q, moderate_func, &m);
+    equeue_dispatch(&q, 1000);
+    test_assert(m.step == 3);
+    test_assert(m.signalled);
+
+    // posts made while a wakeup is due within the window do not signal,
+    // and are still dispatched
+    equeue_moderate(&q, 20);
+    m = (struct moderate){&q, 0, true};
+    equeue_call(&q, moderate_func, &m);
+    equeue_dispatch(&q, 1000);
+    test_assert(m.step == 3);
+    test_assert(!m.signalled);
+
+    // once the loop returns, posts signal again
+    int touched = 0;
+    equeue_call(&q, simple_func, &touched);
+    test_assert(equeue_sema_wait(&q.eventsema, 0));
+    equeue_dispatch(&q, 0);
+    test_assert(touched == 1);
+
+    equeue_destroy(&q);
+}
+
 void background_func(void *p, int ms) {
     *(unsigned *)p = ms;
 }
@@ -584,6 +801,944 @@ void unchain_test(void) {
     equeue_destroy(&q2);
 }
 
+#ifdef EQUEUE_COMPACT
+// Compaction tests
+struct compact_self {
+    equeue_t *q;
+    size_t compacted;
+    bool moved;
+    struct compact_self *result;
+};
+
+void compact_self_func(void *p) {
+    struct compact_self *c = (struct compact_self *)p;
+    c->result->compacted = equeue_compact(c->q);
+    c->result->moved = (unsigned char *)p >= c->q->slab.data;
+}
+
+void compact_test(void) {
+    equeue_t q;
+    int err = equeue_create(&q, 4096);
+    test_assert(!err);
+
+    int log[16];
+    int count = 0;
+    int ids[16];
+    for (int i = 0; i < 16; i++) {
+        struct order *o = equeue_alloc(&q, sizeof(struct order));
+        test_assert(o);
+        o->log = log;
+        o->count = &count;
+        o->value = i;
+        equeue_event_delay(o, 20 + i);
+        ids[i] = equeue_post(&q, order_func, o);
+        test_assert(ids[i]);
+    }
+
+    // leave holes at the bottom of the buffer
+    for (int i = 0; i < 8; i++) {
+        equeue_cancel(&q, ids[i]);
+    }
+
+    size_t slab = q.slab.size;
+    size_t compacted = equeue_compact(&q);
+    test_assert(compacted > 0);
+    test_assert(q.slab.size == slab + compacted);
+
+    // moved events keep their ids
+    equeue_cancel(&q, ids[15]);
+    equeue_dispatch(&q, 50);
+    test_assert(count == 7);
+    for (int i = 0; i < 7; i++) {
+        test_assert(log[i] == 8 + i);
+    }
+
+    // unposted events are never moved
+    void *pinned = equeue_alloc(&q, 256);
+    test_assert(pinned);
+    equeue_compact(&q);
+    test_assert((unsigned char *)pinned < q.slab.data);
+
+    equeue_dealloc(&q, pinned);
+    equeue_compact(&q);
+    test_assert(q.slab.data == q.buffer);
+
+    // reused handles do not revive old ids
+    struct order *o = equeue_alloc(&q, sizeof(struct order));
+    test_assert(o);
+    o->log = log;
+    o->count = &count;
+    o->value = 16;
+    int id = equeue_post(&q, order_func, o);
+    for (int i = 0; i < 16; i++) {
+        test_assert(ids[i] != id);
+        equeue_cancel(&q, ids[i]);
+    }
+
+    equeue_dispatch(&q, 0);
+    test_assert(count == 8);
+    test_assert(log[7] == 16);
+
+    // events being dispatched are never moved
+    equeue_compact(&q);
+    void *hole = equeue_alloc(&q, 64);
+    test_assert(hole);
+    struct compact_self *c = equeue_alloc(&q, sizeof(struct compact_self));
+    test_assert(c);
+    struct compact_self result = {&q, -1, true, 0};
+    c->q = &q;
+    c->result = &result;
+    id = equeue_post(&q, compact_self_func, c);
+    test_assert(id);
+    equeue_dealloc(&q, hole);
+
+    equeue_dispatch(&q, 0);
+    test_assert(result.compacted == 0);
+    test_assert(!result.moved);
+
+    equeue_compact(&q);
+    test_assert(q.slab.data == q.buffer);
+
+    equeue_destroy(&q);
+}
+#endif
+
+#ifdef __linux__
+int fd_readable(int fd, int ms) {
+    struct pollfd p = {.fd = fd, .events = POLLIN};
+    return poll(&p, 1, ms) == 1 && (p.revents & POLLIN);
+}
+
+void fd_test(void) {
+    equeue_t q;
+    int err = equeue_create(&q, 2048);
+    test_assert(!err);
+
+    int fd = equeue_fd(&q);
+    test_assert(fd >= 0);
+    test_assert(equeue_fd(&q) == fd);
+    test_assert(!fd_readable(fd, 0));
+
+    // posts wake the loop immediately
+    int touched = 0;
+    int id = equeue_call(&q, simple_func, &touched);
+    test_assert(id);
+    test_assert(fd_readable(fd, 0));
+
+    equeue_dispatch(&q, 0);
+    test_assert(touched == 1);
+    test_assert(!fd_readable(fd, 0));
+
+    // delayed events wake the loop when they are due
+    id = equeue_call_in(&q, 20, simple_func, &touched);
+    test_assert(id);
+    test_assert(!fd_readable(fd, 10));
+    test_assert(fd_readable(fd, 100));
+
+    equeue_dispatch(&q, 0);
+    test_assert(touched == 2);
+    test_assert(!fd_readable(fd, 0));
+
+    // cancelled events may leave a spurious wakeup, but no work
+    id = equeue_call_in(&q, 10, simple_func, &touched);
+    test_assert(id);
+    equeue_cancel(&q, id);
+    if (fd_readable(fd, 50)) {
+        equeue_dispatch(&q, 0);
+    }
+    test_assert(touched == 2);
+    test_assert(!fd_readable(fd, 0));
+
+    // periodic events keep the descriptor armed
+    id = equeue_call_every(&q, 10, simple_func, &touched);
+    test_assert(id);
+    for (int i = 0; i < 3; i++) {
+        test_assert(fd_readable(fd, 100));
+        equeue_dispatch(&q, 0);
+    }
+    test_assert(touched == 5);
+    equeue_fd_close(&q);
+
+    // replacing a chain releases its context
+    equeue_t q2;
+    err = equeue_create(&q2, 2048);
+    test_assert(!err);
+    for (int i = 0; i < 100; i++) {
+        equeue_chain(&q, &q2);
+        test_assert(equeue_fd(&q) >= 0);
+        equeue_fd_close(&q);
+    }
+
+    equeue_destroy(&q2);
+    equeue_destroy(&q);
+}
+
+struct source_record {
+    equeue_t *q;
+    int count;
+    int value;
+};
+
+void source_signal_func(void *p, struct signalfd_siginfo *info) {
+    struct source_record *r = (struct source_record *)p;
+    r->count += 1;
+    r->value = info->ssi_signo;
+    equeue_break(r->q);
+}
+
+void source_child_func(void *p, siginfo_t *info) {
+    struct source_record *r = (struct source_record *)p;
+    r->count += 1;
+    r->value = info->si_status;
+    equeue_break(r->q);
+}
+
+void source_inotify_func(void *p, struct inotify_event *event) {
+    struct source_record *r = (struct source_record *)p;
+    r->count += 1;
+    r->value = event->mask;
+    equeue_break(r->q);
+}
+
+void source_test(void) {
+    equeue_t q;
+    int err = equeue_create(&q, 2048);
+    test_assert(!err);
+
+    // signals
+    sigset_t mask, old;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &mask, &old);
+
+    struct source_record r = {&q, 0, 0};
+    equeue_source_t signals;
+    err = equeue_source_signal(&signals, &q, &mask, source_signal_func, &r);
+    test_assert(!err);
+
+    pthread_kill(pthread_self(), SIGUSR1);
+    equeue_dispatch(&q, 1000);
+    test_assert(r.count == 1);
+    test_assert(r.value == SIGUSR1);
+
+    equeue_source_destroy(&signals);
+    pthread_sigmask(SIG_SETMASK, &old, 0);
+
+    // child exits
+    pid_t pid = fork();
+    if (!pid) {
+        usleep(10000);
+        _exit(3);
+    }
+    test_assert(pid > 0);
+
+    equeue_source_t child;
+    err = equeue_source_child(&child, &q, pid, source_child_func, &r);
+    test_assert(!err);
+
+    equeue_dispatch(&q, 1000);
+    test_assert(r.count == 2);
+    test_assert(r.value == 3);
+    test_assert(waitpid(pid, 0, WNOHANG) < 0);
+
+    equeue_source_destroy(&child);
+
+    // file changes
+    char path[] = "/tmp/equeue-XXXXXX";
+    int fd = mkstemp(path);
+    test_assert(fd >= 0);
+
+    equeue_source_t files;
+    err = equeue_source_inotify(&files, &q, path, IN_MODIFY,
+            source_inotify_func, &r);
+    test_assert(!err);
+
+    test_assert(write(fd, "hi", 2) == 2);
+    equeue_dispatch(&q, 1000);
+    test_assert(r.count == 3);
+    test_assert(r.value == IN_MODIFY);
+    test_assert(!files.dropped);
+
+    equeue_source_destroy(&files);
+    close(fd);
+    unlink(path);
+
+    // timers keep working alongside the sources
+    int touched = 0;
+    equeue_call_in(&q, 10, simple_func, &touched);
+    equeue_dispatch(&q, 50);
+    test_assert(touched == 1);
+
+    equeue_destroy(&q);
+}
+
+struct source_datagrams {
+    equeue_t *q;
+    int count;
+    int order;
+    int truncated;
+};
+
+void source_recv_func(void *p, struct equeue_datagram *d) {
+    struct source_datagrams *r = (struct source_datagrams *)p;
+    if (d->size != sizeof(int) || *(int *)d->data != r->count) {
+        r->order = false;
+    }
+    if (d->flags & MSG_TRUNC) {
+        r->truncated += 1;
+    }
+
+    r->count += 1;
+    if (r->count == 40) {
+        equeue_break(r->q);
+    }
+}
+
+void source_spin_func(void *p) {
+    struct source_datagrams *r = (struct source_datagrams *)p;
+    if (r->count < 40) {
+        equeue_call(r->q, source_spin_func, r);
+    }
+}
+
+void source_recv_test(void) {
+    equeue_t q;
+    int err = equeue_create(&q, 8192);
+    test_assert(!err);
+
+    int sv[2];
+    err = socketpair(AF_UNIX, SOCK_DGRAM, 0, sv);
+    test_assert(!err);
+
+    struct source_datagrams r = {&q, 0, true, 0};
+    equeue_source_t source;
+    err = equeue_source_recv(&source, &q, sv[0], sizeof(int),
+            source_recv_func, &r);
+    test_assert(!err);
+
+    // more datagrams than fit in a single batch
+    for (int i = 0; i < 39; i++) {
+        test_assert(send(sv[1], &i, sizeof(i), 0) == sizeof(i));
+    }
+    int big[4] = {39};
+    test_assert(send(sv[1], big, sizeof(big), 0) == sizeof(big));
+
+    equeue_dispatch(&q, 1000);
+    test_assert(r.count == 40);
+    test_assert(r.order);
+    test_assert(r.truncated == 1);
+    test_assert(!source.dropped);
+
+    // a queue kept busy by posts still services its sources
+    r.count = 0;
+    equeue_call(&q, source_spin_func, &r);
+    for (int i = 0; i < 40; i++) {
+        test_assert(send(sv[1], &i, sizeof(i), 0) == sizeof(i));
+    }
+
+    equeue_dispatch(&q, 1000);
+    test_assert(r.count == 40);
+    test_assert(r.order);
+
+    // also in single-threaded mode, which otherwise skips the wait
+    equeue_single_thread(&q, true);
+    r.count = 0;
+    equeue_call(&q, source_spin_func, &r);
+    for (int i = 0; i < 40; i++) {
+        test_assert(send(sv[1], &i, sizeof(i), 0) == sizeof(i));
+    }
+
+    equeue_dispatch(&q, 1000);
+    test_assert(r.count == 40);
+    test_assert(r.order);
+
+    equeue_source_destroy(&source);
+    close(sv[0]);
+    close(sv[1]);
+    equeue_destroy(&q);
+}
+#endif
+
+#ifdef EQUEUE_TRACE
+// Trace tests
+struct trace_counts {
+    int types[EQUEUE_TRACE_NOMEM+1];
+    void (*cb)(void *);
+    unsigned count;
+};
+
+void trace_func(void *p, const struct equeue_trace_record *r) {
+    struct trace_counts *counts = (struct trace_counts *)p;
+    counts->types[r->type] += 1;
+    if (r->type == EQUEUE_TRACE_CALL) {
+        counts->cb = r->cb;
+    } else if (r->type == EQUEUE_TRACE_BATCH) {
+        counts->count = r->count;
+    }
+}
+
+void trace_test(void) {
+    equeue_t q;
+    int err = equeue_create(&q, 2048);
+    test_assert(!err);
+
+    struct trace_counts counts;
+    memset(&counts, 0, sizeof(counts));
+    equeue_trace(&q, trace_func, &counts);
+
+    int touched = 0;
+    equeue_call(&q, simple_func, &touched);
+    equeue_call(&q, simple_func, &touched);
+    int id = equeue_call_in(&q, 100, simple_func, &touched);
+    equeue_cancel(&q, id);
+    test_assert(!equeue_alloc(&q, 4096));
+
+    equeue_dispatch(&q, 5);
+    test_assert(touched == 2);
+
+    test_assert(counts.types[EQUEUE_TRACE_POST] == 3);
+    test_assert(counts.types[EQUEUE_TRACE_CANCEL] == 1);
+    test_assert(counts.types[EQUEUE_TRACE_NOMEM] == 1);
+    test_assert(counts.types[EQUEUE_TRACE_BATCH] == 1);
+    test_assert(counts.count == 2);
+    test_assert(counts.types[EQUEUE_TRACE_CALL] == 2);
+    test_assert(counts.types[EQUEUE_TRACE_RETURN] == 2);
+    test_assert(counts.cb == simple_func);
+    test_assert(counts.types[EQUEUE_TRACE_SLEEP] >= 1);
+    test_assert(counts.types[EQUEUE_TRACE_WAKE]
+            == counts.types[EQUEUE_TRACE_SLEEP]);
+
+    equeue_trace(&q, 0, 0);
+    equeue_call(&q, simple_func, &touched);
+    test_assert(counts.types[EQUEUE_TRACE_POST] == 3);
+
+    equeue_destroy(&q);
+}
+
+void trace_chrome_test(void) {
+    equeue_t q;
+    int err = equeue_create(&q, 2048);
+    test_assert(!err);
+
+    FILE *f = tmpfile();
+    test_assert(f);
+    err = equeue_trace_chrome(&q, f);
+    test_assert(!err);
+
+    int touched = 0;
+    equeue_call(&q, simple_func, &touched);
+    equeue_dispatch(&q, 0);
+    test_assert(touched == 1);
+
+    char buffer[4096];
+    rewind(f);
+    size_t size = fread(buffer, 1, sizeof(buffer)-1, f);
+    buffer[size] = '\0';
+    fclose(f);
+
+    test_assert(buffer[0] == '[');
+    test_assert(strstr(buffer, "\"name\":\"post\""));
+    test_assert(strstr(buffer, "\"name\":\"dequeue\""));
+    test_assert(strstr(buffer, "\"cat\":\"callback\",\"ph\":\"B\""));
+    test_assert(strstr(buffer, "\"cat\":\"callback\",\"ph\":\"E\""));
+
+    equeue_destroy(&q);
+}
+
+void trace_log_test(void) {
+    equeue_t q;
+    int err = equeue_create(&q, 2048);
+    test_assert(!err);
+
+    FILE *f = tmpfile();
+    test_assert(f);
+    err = equeue_trace_log(&q, f);
+    test_assert(!err);
+
+    int touched = 0;
+    int id = equeue_call_in(&q, 10, simple_func, &touched);
+    equeue_call_every(&q, 20, simple_func, &touched);
+    equeue_cancel(&q, id);
+    equeue_dispatch(&q, 0);
+    equeue_trace(&q, 0, 0);
+
+    char magic[sizeof(EQUEUE_LOG_MAGIC)];
+    struct equeue_log_record records[4];
+    rewind(f);
+    test_assert(fread(magic, sizeof(magic), 1, f) == 1);
+    test_assert(memcmp(magic, EQUEUE_LOG_MAGIC, sizeof(magic)) == 0);
+    size_t count = fread(records, sizeof(records[0]), 4, f);
+    fclose(f);
+
+    test_assert(count == 3);
+    test_assert(records[0].type == EQUEUE_LOG_POST);
+    test_assert(records[0].id == id);
+    test_assert(records[0].delay == 10);
+    test_assert(records[0].period == -1);
+    test_assert(records[0].size >= 2*sizeof(void*));
+    test_assert(records[1].type == EQUEUE_LOG_POST);
+    test_assert(records[1].delay == 20);
+    test_assert(records[1].period == 20);
+    test_assert(records[2].type == EQUEUE_LOG_CANCEL);
+    test_assert(records[2].id == id);
+    test_assert((int32_t)(records[2].time - records[0].time) >= 0);
+
+    equeue_destroy(&q);
+}
+#endif
+
+#ifdef EQUEUE_PROFILE
+// Profile tests
+void profile_test(void) {
+    equeue_t q;
+    int err = equeue_create(&q, 2048);
+    test_assert(!err);
+
+    int touched = 0;
+    equeue_call(&q, simple_func, &touched);
+    equeue_call(&q, simple_func, &touched);
+    equeue_call(&q, sloth_func, &touched);
+    equeue_dispatch(&q, 0);
+    test_assert(touched == 3);
+
+    const struct equeue_profile *simple = 0;
+    const struct equeue_profile *sloth = 0;
+    for (int i = 0; i < EQUEUE_PROFILE_SIZE; i++) {
+        if (q.profiler.entries[i].cb == simple_func) {
+            simple = &q.profiler.entries[i];
+        } else if (q.profiler.entries[i].cb == sloth_func) {
+            sloth = &q.profiler.entries[i];
+        }
+    }
+
+    test_assert(simple && simple->calls == 2);
+    test_assert(sloth && sloth->calls == 1);
+    test_assert(sloth->max_runtime >= 10000);
+    test_assert(sloth->runtime == sloth->max_runtime);
+    test_assert(q.profiler.untracked == 0);
+
+    FILE *f = tmpfile();
+    test_assert(f);
+    equeue_profile_dump(&q, f);
+
+    char buffer[1024];
+    rewind(f);
+    size_t size = fread(buffer, 1, sizeof(buffer)-1, f);
+    buffer[size] = '\0';
+    fclose(f);
+
+    // sorted by total runtime
+    char *a = strstr(buffer, "sloth_func");
+    char *b = strstr(buffer, "simple_func");
+    test_assert(a && b && a < b);
+
+    equeue_profile_reset(&q);
+    test_assert(q.profiler.entries[0].calls == 0);
+    for (int i = 0; i < EQUEUE_PROFILE_SIZE; i++) {
+        test_assert(!q.profiler.entries[i].cb);
+    }
+
+    equeue_destroy(&q);
+}
+#endif
+
+#ifdef EQUEUE_WATCHDOG
+// Watchdog tests
+struct watchdog_state {
+    int overruns;
+    struct equeue_overrun last;
+};
+
+void watchdog_func(void *p, const struct equeue_overrun *o) {
+    struct watchdog_state *state = (struct watchdog_state *)p;
+    state->overruns += 1;
+    state->last = *o;
+}
+
+struct watchdog_check {
+    equeue_watchdog_t *watchdog;
+    int reports;
+};
+
+void watchdog_check_func(void *p) {
+    struct watchdog_check *check = (struct watchdog_check *)p;
+    usleep(20000);
+    check->reports += equeue_watchdog_check(check->watchdog);
+    check->reports += equeue_watchdog_check(check->watchdog);
+}
+
+void watchdog_test(void) {
+    equeue_t q;
+    int err = equeue_create(&q, 2048);
+    test_assert(!err);
+
+    struct watchdog_state state = {0};
+    equeue_watchdog_t w;
+    equeue_watchdog_create(&w, &q, 10, watchdog_func, &state);
+    test_assert(!equeue_watchdog_check(&w));
+
+    // polled from inside the slow callback
+    struct watchdog_check check = {&w, 0};
+    int id = equeue_call(&q, watchdog_check_func, &check);
+    equeue_dispatch(&q, 0);
+    test_assert(check.reports == 1);
+    test_assert(state.overruns == 1);
+    test_assert(state.last.cb == watchdog_check_func);
+    test_assert(state.last.id == id);
+    test_assert(state.last.duration >= 10);
+    test_assert(!equeue_watchdog_check(&w));
+
+    // fast callbacks are never reported
+    int touched = 0;
+    equeue_call(&q, simple_func, &touched);
+    equeue_dispatch(&q, 0);
+    test_assert(touched == 1);
+    test_assert(state.overruns == 1);
+
+    // polled from a background thread
+    equeue_watchdog_create(&w, &q, 2, watchdog_func, &state);
+    err = equeue_watchdog_start(&w);
+    test_assert(!err);
+    equeue_call(&q, sloth_func, &touched);
+    equeue_call(&q, simple_func, &touched);
+    equeue_call(&q, sloth_func, &touched);
+    equeue_dispatch(&q, 0);
+    equeue_watchdog_stop(&w);
+    test_assert(touched == 4);
+    test_assert(state.overruns == 3);
+    test_assert(state.last.cb == sloth_func);
+
+    equeue_destroy(&q);
+}
+#endif
+
+// Channel tests
+struct chan_state {
+    int sum;
+    int msgs;
+    int batches;
+};
+
+void chan_func(void *p, void *msgs, unsigned count) {
+    struct chan_state *state = (struct chan_state *)p;
+    for (unsigned i = 0; i < count; i++) {
+        state->sum += ((int *)msgs)[i];
+    }
+
+    state->msgs += count;
+    state->batches += 1;
+}
+
+void chan_test(void) {
+    equeue_t q;
+    int err = equeue_create(&q, 2048);
+    test_assert(!err);
+
+    struct chan_state state = {0, 0, 0};
+    equeue_chan_t chan;
+    err = equeue_chan_create(&chan, &q, sizeof(int), 8, chan_func, &state);
+    test_assert(!err);
+
+    for (int i = 0; i < 5; i++) {
+        err = equeue_chan_send(&chan, &i);
+        test_assert(!err);
+    }
+
+    equeue_dispatch(&q, 0);
+    test_assert(state.msgs == 5);
+    test_assert(state.sum == 0+1+2+3+4);
+    test_assert(state.batches == 1);
+
+    state.sum = 0;
+    state.msgs = 0;
+    state.batches = 0;
+    for (int i = 0; i < 8; i++) {
+        err = equeue_chan_send(&chan, &i);
+        test_assert(!err);
+    }
+
+    int i = 8;
+    err = equeue_chan_send(&chan, &i);
+    test_assert(err < 0);
+
+    equeue_dispatch(&q, 0);
+    test_assert(state.msgs == 8);
+    test_assert(state.sum == 0+1+2+3+4+5+6+7);
+    test_assert(state.batches == 2);
+
+    equeue_chan_destroy(&chan);
+    equeue_destroy(&q);
+}
+
+// Topic tests
+void topic_func(void *p, const void *payload) {
+    *(int *)p += *(const int *)payload;
+}
+
+void topic_test(void) {
+    equeue_t arena;
+    int err = equeue_create(&arena, 2048);
+    test_assert(!err);
+
+    equeue_t qs[3];
+    int touched[3] = {0, 0, 0};
+    equeue_topic_t topic;
+    err = equeue_topic_create(&topic, &arena);
+    test_assert(!err);
+
+    void *subs[3];
+    for (int i = 0; i < 3; i++) {
+        err = equeue_create(&qs[i], 2048);
+        test_assert(!err);
+
+        subs[i] = equeue_topic_subscribe(&topic, &qs[i],
+                topic_func, &touched[i]);
+        test_assert(subs[i]);
+    }
+
+    int *payload = equeue_topic_alloc(&topic, 64*sizeof(int));
+    test_assert(payload);
+    *payload = 3;
+
+    int count = equeue_topic_publish(&topic, payload);
+    test_assert(count == 3);
+
+    equeue_dispatch(&qs[0], 0);
+    equeue_dispatch(&qs[1], 0);
+    test_assert(touched[0] == 3 && touched[1] == 3 && touched[2] == 0);
+
+    // the payload is still referenced by the last subscriber
+    int *other = equeue_topic_alloc(&topic, 64*sizeof(int));
+    test_assert(other && other != payload);
+    equeue_topic_dealloc(&topic, other);
+
+    equeue_dispatch(&qs[2], 0);
+    test_assert(touched[2] == 3);
+
+    // unsubscribed queues don't receive anything
+    equeue_topic_unsubscribe(&topic, subs[1]);
+    payload = equeue_topic_alloc(&topic, 64*sizeof(int));
+    test_assert(payload);
+    *payload = 1;
+
+    count = equeue_topic_publish(&topic, payload);
+    test_assert(count == 2);
+
+    for (int i = 0; i < 3; i++) {
+        equeue_dispatch(&qs[i], 0);
+    }
+    test_assert(touched[0] == 4 && touched[1] == 3 && touched[2] == 4);
+
+    // cancelled deliveries release the payload as well
+    payload = equeue_topic_alloc(&topic, 64*sizeof(int));
+    test_assert(payload);
+    *payload = 1;
+    count = equeue_topic_publish(&topic, payload);
+    test_assert(count == 2);
+
+    for (int i = 0; i < 3; i++) {
+        equeue_destroy(&qs[i]);
+    }
+
+    other = equeue_topic_alloc(&topic, 64*sizeof(int));
+    test_assert(other == payload);
+    equeue_topic_dealloc(&topic, other);
+
+    equeue_topic_destroy(&topic);
+    equeue_destroy(&arena);
+}
+
+// External payload tests
+void buf_func(void *p, const void *payload, size_t size) {
+    *(int *)p += ((const uint8_t *)payload)[size-1];
+}
+
+void buf_release(void *p, const void *payload) {
+    *(int *)p += 1;
+}
+
+void buf_test(void) {
+    static uint8_t payload[32*1024];
+    payload[sizeof(payload)-1] = 2;
+
+    equeue_t qs[2];
+    for (int i = 0; i < 2; i++) {
+        int err = equeue_create(&qs[i], 2048);
+        test_assert(!err);
+    }
+
+    int released = 0;
+    equeue_buf_t buf;
+    int err = equeue_buf_create(&buf, payload, sizeof(payload),
+            buf_release, &released);
+    test_assert(!err);
+
+    int touched = 0;
+    for (int i = 0; i < 2; i++) {
+        int id = equeue_buf_call(&buf, &qs[i], 0, buf_func, &touched);
+        test_assert(id);
+    }
+    int id = equeue_buf_call(&buf, &qs[0], 10, buf_func, &touched);
+    test_assert(id);
+    equeue_buf_release(&buf);
+
+    // each event holds a reference until it is dispatched or cancelled
+    equeue_dispatch(&qs[0], 0);
+    test_assert(touched == 2 && released == 0);
+
+    equeue_cancel(&qs[0], id);
+    test_assert(released == 0);
+
+    equeue_dispatch(&qs[1], 0);
+    test_assert(touched == 4 && released == 1);
+
+    for (int i = 0; i < 2; i++) {
+        equeue_destroy(&qs[i]);
+    }
+}
+
+// Parallel tests
+struct parallel {
+    equeue_group_t group;
+    equeue_t queues[4];
+    equeue_t *queue_ptrs[4];
+    pthread_t threads[4];
+    int touched[1000];
+    int err;
+    equeue_sema_t done;
+};
+
+void parallel_for_func(void *p, size_t begin, size_t end) {
+    int *touched = (int *)p;
+    for (size_t i = begin; i < end; i++) {
+        touched[i] += 1;
+    }
+}
+
+void parallel_map_func(void *p, size_t begin, size_t end, void *acc) {
+    for (size_t i = begin; i < end; i++) {
+        *(uint64_t *)acc += i;
+    }
+}
+
+void parallel_combine_func(void *p, void *result, const void *acc) {
+    *(uint64_t *)result += *(const uint64_t *)acc;
+}
+
+void parallel_nested_func(void *p) {
+    struct parallel *parallel = (struct parallel *)p;
+    parallel->err = equeue_parallel_for(&parallel->group, 0, 1000, 7,
+            parallel_for_func, parallel->touched);
+    equeue_sema_signal(&parallel->done);
+}
+
+static void parallel_create(struct parallel *p) {
+    for (int i = 0; i < 4; i++) {
+        int err = equeue_create(&p->queues[i], 2048);
+        test_assert(!err);
+        p->queue_ptrs[i] = &p->queues[i];
+
+        err = pthread_create(&p->threads[i], 0,
+                multithread_thread, &p->queues[i]);
+        test_assert(!err);
+    }
+
+    p->group.queues = p->queue_ptrs;
+    p->group.count = 4;
+    memset(p->touched, 0, sizeof(p->touched));
+}
+
+static void parallel_destroy(struct parallel *p) {
+    for (int i = 0; i < 4; i++) {
+        equeue_break(&p->queues[i]);
+        int err = pthread_join(p->threads[i], 0);
+        test_assert(!err);
+        equeue_destroy(&p->queues[i]);
+    }
+}
+
+void parallel_for_test(void) {
+    struct parallel p;
+    parallel_create(&p);
+
+    int err = equeue_parallel_for(&p.group, 0, 1000, 16,
+            parallel_for_func, p.touched);
+    test_assert(!err);
+
+    for (int i = 0; i < 1000; i++) {
+        test_assert(p.touched[i] == 1);
+    }
+
+    err = equeue_parallel_for(&p.group, 10, 10, 16,
+            parallel_for_func, p.touched);
+    test_assert(!err);
+
+    parallel_destroy(&p);
+}
+
+void parallel_reduce_test(void) {
+    struct parallel p;
+    parallel_create(&p);
+
+    uint64_t sum = 0;
+    int err = equeue_parallel_reduce(&p.group, 0, 1000, 16,
+            parallel_map_func, parallel_combine_func,
+            0, &sum, 0, sizeof(sum));
+    test_assert(!err);
+    test_assert(sum == 999*1000/2);
+
+    equeue_group_t empty = {0, 0};
+    sum = 0;
+    err = equeue_parallel_reduce(&empty, 0, 1000, 16,
+            parallel_map_func, parallel_combine_func,
+            0, &sum, 0, sizeof(sum));
+    test_assert(!err);
+    test_assert(sum == 999*1000/2);
+
+    // the initial result is counted once, however many participants ran
+    const uint64_t zero = 0;
+    for (int i = 0; i < 10; i++) {
+        sum = 100;
+        err = equeue_parallel_reduce(&p.group, 0, 1000, 16,
+                parallel_map_func, parallel_combine_func,
+                0, &sum, &zero, sizeof(sum));
+        test_assert(!err);
+        test_assert(sum == 100 + 999*1000/2);
+    }
+
+    sum = 100;
+    err = equeue_parallel_reduce(&empty, 0, 1000, 16,
+            parallel_map_func, parallel_combine_func,
+            0, &sum, &zero, sizeof(sum));
+    test_assert(!err);
+    test_assert(sum == 100 + 999*1000/2);
+
+    parallel_destroy(&p);
+}
+
+void parallel_nested_test(void) {
+    struct parallel p;
+    parallel_create(&p);
+
+    int err = equeue_sema_create(&p.done);
+    test_assert(!err);
+
+    p.err = -1;
+    int id = equeue_call(&p.queues[0], parallel_nested_func, &p);
+    test_assert(id);
+
+    bool signalled = equeue_sema_wait(&p.done, -1);
+    test_assert(signalled);
+    equeue_sema_destroy(&p.done);
+    test_assert(!p.err);
+
+    for (int i = 0; i < 1000; i++) {
+        test_assert(p.touched[i] == 1);
+    }
+
+    parallel_destroy(&p);
+}
+
 // Barrage tests
 void simple_barrage_test(int N) {
     equeue_t q;
@@ -684,20 +1839,50 @@ int main() {
     test_run(simple_call_in_test);
     test_run(simple_call_every_test);
     test_run(simple_post_test);
+    test_run(post_batch_test);
     test_run(destructor_test);
     test_run(allocation_failure_test);
+    test_run(realloc_test);
     test_run(cancel_test, 20);
     test_run(cancel_inflight_test);
+    test_run(cancel_sibling_test);
     test_run(cancel_unnecessarily_test);
     test_run(loop_protect_test);
     test_run(break_test);
     test_run(period_test);
     test_run(nested_test);
     test_run(sloth_test);
+    test_run(single_thread_test);
     test_run(background_test);
     test_run(chain_test);
     test_run(unchain_test);
     test_run(multithread_test);
+    test_run(moderate_test);
+#ifdef EQUEUE_COMPACT
+    test_run(compact_test);
+#endif
+#ifdef __linux__
+    test_run(fd_test);
+    test_run(source_test);
+    test_run(source_recv_test);
+#endif
+#ifdef EQUEUE_TRACE
+    test_run(trace_test);
+    test_run(trace_chrome_test);
+    test_run(trace_log_test);
+#endif
+#ifdef EQUEUE_PROFILE
+    test_run(profile_test);
+#endif
+#ifdef EQUEUE_WATCHDOG
+    test_run(watchdog_test);
+#endif
+    test_run(chan_test);
+    test_run(topic_test);
+    test_run(buf_test);
+    test_run(parallel_for_test);
+    test_run(parallel_reduce_test);
+    test_run(parallel_nested_test);
     test_run(simple_barrage_test, 20);
     test_run(fragmenting_barrage_test, 20);
     test_run(multithreaded_barrage_test, 20);